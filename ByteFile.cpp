@@ -2,10 +2,11 @@
 #include "Error.h"
 #include <fstream>
 #include <algorithm>
+#include <cstring>
 
 using namespace lama;
 
-ByteFile::ByteFile(std::unique_ptr<const char[]> data, size_t sizeBytes)
+ByteFile::ByteFile(std::unique_ptr<char[]> data, size_t sizeBytes)
     : data(std::move(data)), sizeBytes(sizeBytes) {
   init();
 }
@@ -83,6 +84,14 @@ const char *ByteFile::getAddressFor(size_t offset) const {
   return code + offset;
 }
 
+void ByteFile::patchCode(size_t offset, const void *bytes, size_t bytesNum) {
+  if (offset > codeSizeBytes || bytesNum > codeSizeBytes - offset) {
+    runtimeError("patch of {} bytes at {:#x} out of bounds [0, {:#x})",
+                 bytesNum, offset, codeSizeBytes);
+  }
+  memcpy(data.get() + (code - data.get()) + offset, bytes, bytesNum);
+}
+
 const char *ByteFile::getStringAt(size_t offset) const {
   if (offset >= stringTableSizeBytes) {
     runtimeError("access string at {:#x} out of bounds [0, {:#x}]", offset,
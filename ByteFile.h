@@ -9,7 +9,7 @@ class GlobalArea;
 class ByteFile {
 public:
   ByteFile() = default;
-  ByteFile(std::unique_ptr<const char[]> data, size_t sizeBytes);
+  ByteFile(std::unique_ptr<char[]> data, size_t sizeBytes);
 
   static ByteFile load(std::string path);
 
@@ -18,13 +18,17 @@ public:
 
   const char *getAddressFor(size_t offset) const;
 
+  /// Overwrites code at `offset`, for load-time rewriting of instructions
+  void patchCode(size_t offset, const void *bytes, size_t bytesNum);
+
   const char *getStringAt(size_t offset) const;
+  size_t getStringTableSizeBytes() const { return stringTableSizeBytes; }
 
 private:
   void init();
 
 private:
-  std::unique_ptr<const char[]> data;
+  std::unique_ptr<char[]> data;
   size_t sizeBytes;
 
   const char *stringTable;
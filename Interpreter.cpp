@@ -2,9 +2,14 @@
 #include "ByteFile.h"
 #include "Error.h"
 #include "Value.h"
+// Object layout shared with the runtime, both are built without DEBUG_VERSION
+#include "runtime/runtime_common.h"
 #include <algorithm>
 #include <array>
+#include <cstring>
 #include <iostream>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 using namespace lama;
@@ -15,6 +20,13 @@ extern Value __start_custom_data;
 extern Value __stop_custom_data;
 extern Value *__gc_stack_top;
 extern Value *__gc_stack_bottom;
+extern Value *__gc_stack_watermark;
+extern Value *__gc_stack_frame_limit;
+extern bool gc_marking_in_progress;
+void gc_satb_record(void *oldValue);
+void gc_advise_huge_pages(void *begin, size_t bytes);
+extern size_t gc_alloc_site;
+extern size_t gc_census_code_base;
 
 void __gc_init();
 
@@ -31,19 +43,64 @@ extern void *Barray_(void *stack_top, int n);
 extern int LtagHash(char *tagString);
 extern void *Bsexp(int bn, ...);
 extern void *Bsexp_(void *stack_top, int n);
-extern int Btag(void *d, int t, int n);
 [[noreturn]] extern void Bmatch_failure(void *v, char *fname, int line,
                                         int col);
 extern void *Bclosure(int bn, void *entry, ...);
 extern void *Bclosure_(void *stack_top, int n, void *entry);
 extern int Bstring_patt(void *x, void *y);
-extern int Bclosure_tag_patt(void *x);
-extern int Bboxed_patt(void *x);
-extern int Bunboxed_patt(void *x);
-extern int Barray_tag_patt(void *x);
-extern int Bstring_tag_patt(void *x);
-extern int Bsexp_tag_patt(void *x);
-extern int Barray_patt(void *d, int n);
+
+// The rest of the Std interface, see `nativeFunctions`
+void Lassert(void *f, char *s, ...);
+extern void *LgetEnv(char *var);
+extern int Lsystem(char *cmd);
+extern void *LstringInt(char *b);
+extern void *LmakeArray(int length);
+extern void *Lclone(void *p);
+extern int Lhash(void *p);
+extern void *Lfst(void *v);
+extern void *Lsnd(void *v);
+extern void *Lhd(void *v);
+extern void *Ltl(void *v);
+extern void *LreadLine();
+extern void *Lstringcat(void *p);
+extern int LmatchSubString(char *subj, char *patt, int pos);
+extern void *Lsubstring(void *subj, int p, int l);
+extern void *Lregexp(char *regexp);
+extern int LregexpMatch(void *b, char *s, int pos);
+extern void *Lsprintf(char *fmt, ...);
+extern void *LmakeString(int length);
+extern void Lprintf(char *s, ...);
+extern void LprintfPerror(char *s, ...);
+extern void Lfprintf(void *f, char *s, ...);
+extern void *Lfopen(char *f, char *m);
+extern void Lfclose(void *f);
+extern void *Lfread(char *fname);
+extern void Lfwrite(char *fname, char *contents);
+extern void *Lfexists(char *fname);
+extern void Lfailure(char *s, ...);
+extern int Lcompare(void *p, void *q);
+extern void *Li__Infix_4343(void *a, void *b);
+extern void *Ls__Infix_58(void *p, void *q);
+extern int Ls__Infix_3333(void *p, void *q);
+extern int Ls__Infix_3838(void *p, void *q);
+extern int Ls__Infix_6161(void *p, void *q);
+extern int Ls__Infix_3361(void *p, void *q);
+extern int Ls__Infix_6061(void *p, void *q);
+extern int Ls__Infix_60(void *p, void *q);
+extern int Ls__Infix_6261(void *p, void *q);
+extern int Ls__Infix_62(void *p, void *q);
+extern int Ls__Infix_43(void *p, void *q);
+extern int Ls__Infix_45(void *p, void *q);
+extern int Ls__Infix_42(void *p, void *q);
+extern int Ls__Infix_47(void *p, void *q);
+extern int Ls__Infix_37(void *p, void *q);
+extern int Lrandom(int n);
+extern int Ltime();
+extern int LkindOf(void *p);
+extern int LcompareTags(void *p, void *q);
+extern int LflatCompare(void *p, void *q);
+extern int Luppercase(void *v);
+extern int Llowercase(void *v);
 }
 
 enum VarDesignation {
@@ -104,6 +161,9 @@ enum InstCode {
   I_ARRAY = 0x58,
   I_FAIL = 0x59,
   I_LINE = 0x5a,
+  // Not emitted by lamac, replaces chains of pattern tests at load time, see
+  // `CaseSwitch`
+  I_CASE_Switch = 0x5b,
 
   I_PATT_StrCmp = 0x60,
   I_PATT_String = 0x61,
@@ -118,6 +178,7 @@ enum InstCode {
   I_CALL_Llength = 0x72,
   I_CALL_Lstring = 0x73,
   I_CALL_Barray = 0x74,
+  I_CALL_Native = 0x75,
 };
 
 static void initGlobalArea() {
@@ -130,6 +191,8 @@ static Value &accessGlobal(uint32_t index) {
 }
 
 #define STACK_SIZE (1 << 20)
+// The stack may be backed by transparent huge pages, see HUGE_PAGE_SIZE in gc.h
+#define STACK_ALIGNMENT (1 << 21)
 #define FRAME_STACK_SIZE (1 << 16)
 
 namespace {
@@ -137,11 +200,14 @@ namespace {
 struct Stack {
 
   static void init() {
+    gc_advise_huge_pages(data.data(), sizeof(data));
     __gc_stack_bottom = data.end();
     frame.base = __gc_stack_bottom;
     // Two arguments to main: argc and argv
     __gc_stack_top = __gc_stack_bottom - 3;
     frame.operandStackBase = frame.base;
+    frame.limit = __gc_stack_bottom;
+    __gc_stack_frame_limit = frame.limit;
   }
 
   static size_t getOperandStackSize() {
@@ -198,6 +264,13 @@ struct Stack {
 
   static Value *&top() { return __gc_stack_top; }
 
+  // Called on writes through references, which may point to older frames
+  static void noteWrite(Value *address) {
+    if (address >= __gc_stack_watermark && address < __gc_stack_bottom) {
+      __gc_stack_watermark = address + 1;
+    }
+  }
+
 private:
   static void checkNonEmptyOperandStack() {
     if (getOperandStackSize() == 0) {
@@ -206,7 +279,7 @@ private:
   }
 
 private:
-  static std::array<Value, STACK_SIZE> data;
+  alignas(STACK_ALIGNMENT) static std::array<Value, STACK_SIZE> data;
 
   struct Frame {
     Value *base;
@@ -215,6 +288,8 @@ private:
     size_t nlocals;
     Value *operandStackBase;
     const char *returnAddress;
+    // The frame (its arguments included) lies below this address
+    Value *limit;
   };
 
   static Frame frame;
@@ -227,7 +302,7 @@ private:
 
 } // namespace
 
-std::array<Value, STACK_SIZE> Stack::data;
+alignas(STACK_ALIGNMENT) std::array<Value, STACK_SIZE> Stack::data;
 
 Stack::Frame Stack::frame;
 std::array<Stack::Frame, FRAME_STACK_SIZE> Stack::frameStack;
@@ -271,6 +346,8 @@ void Stack::beginFunction(size_t nargs, size_t nlocals) {
   frame.nlocals = nlocals;
   frame.operandStackBase = top() + 1;
   frame.returnAddress = nextReturnAddress;
+  frame.limit = newBase + noperands;
+  __gc_stack_frame_limit = frame.limit;
   // Fill with some boxed values so that GC will skip these
   memset(top() + 1, 1, (char *)frame.base - (char *)(top() + 1));
 }
@@ -288,6 +365,11 @@ const char *Stack::endFunction() {
   Value ret = peakOperand();
   frame = frameStack[--frameStackSize];
   top() = frame.top;
+  // The caller's frame is going to be modified, so it is not clean anymore
+  __gc_stack_frame_limit = frame.limit;
+  if (__gc_stack_watermark < frame.limit) {
+    __gc_stack_watermark = frame.limit;
+  }
   pushOperand(ret);
   return returnAddress;
 }
@@ -308,11 +390,417 @@ static Value createSexp(size_t nargs) {
   return reinterpret_cast<Value>(Bsexp_(Stack::top() + 1, nargs));
 }
 
+// The pattern tests of runtime.c (`Btag`, `Barray_patt`, `Bsexp_tag_patt`,
+// ...) done in place on headers laid out as in runtime_common.h
+
+static int headerOf(Value value) { return TO_DATA(value)->data_header; }
+
+static bool hasKind(Value value, int kind) {
+  return valueIsPtr(value) && TAG(headerOf(value)) == kind;
+}
+
+static bool isSexp(Value value, int32_t tag, int32_t nfields) {
+  if (valueIsInt(value))
+    return false;
+  int header = headerOf(value);
+  return TAG(header) == SEXP_TAG && TO_SEXP(value)->tag == tag &&
+         static_cast<int32_t>(LEN(header)) == nfields;
+}
+
+static bool isArray(Value value, int32_t nelems) {
+  if (valueIsInt(value))
+    return false;
+  int header = headerOf(value);
+  return TAG(header) == ARRAY_TAG &&
+         static_cast<int32_t>(LEN(header)) == nelems;
+}
+
+static bool isEqualString(Value value, Value pattern) {
+  if (!hasKind(pattern, STRING_TAG)) {
+    // Let the runtime report the malformed pattern
+    return unboxInt(Bstring_patt(reinterpret_cast<void *>(value),
+                                 reinterpret_cast<void *>(pattern)));
+  }
+  return hasKind(value, STRING_TAG) &&
+         strcmp(reinterpret_cast<const char *>(value),
+                reinterpret_cast<const char *>(pattern)) == 0;
+}
+
+// `Belem` and `Bsta` for arrays, sexps and strings indexed by an integer, the
+// runtime is left the rest, including the failures
+
+static bool loadElement(Value container, Value index, Value &element) {
+  if (valueIsInt(container) || !valueIsInt(index))
+    return false;
+  int32_t i = unboxInt(index);
+  switch (TAG(headerOf(container))) {
+  case ARRAY_TAG:
+    element = reinterpret_cast<Value *>(container)[i];
+    return true;
+  case SEXP_TAG:
+    element = TO_SEXP(container)->contents[i];
+    return true;
+  case STRING_TAG:
+    element = boxInt(reinterpret_cast<char *>(container)[i]);
+    return true;
+  }
+  return false;
+}
+
+static bool storeElement(Value container, Value index, Value value) {
+  if (valueIsInt(container) || !valueIsInt(index))
+    return false;
+  int32_t i = unboxInt(index);
+  Value *field;
+  switch (TAG(headerOf(container))) {
+  case ARRAY_TAG:
+    field = reinterpret_cast<Value *>(container) + i;
+    break;
+  case SEXP_TAG:
+    field = TO_SEXP(container)->contents + i;
+    break;
+  case STRING_TAG:
+    reinterpret_cast<char *>(container)[i] = static_cast<char>(value >> 1);
+    return true;
+  default:
+    return false;
+  }
+  // `gc_write_barrier` of runtime/gc.h
+  if (gc_marking_in_progress) {
+    gc_satb_record(reinterpret_cast<void *>(*field));
+  }
+  *field = value;
+  return true;
+}
+
 static Value createClosure(const char *entry, size_t nvars) {
   return reinterpret_cast<Value>(
       Bclosure_(Stack::top() + 1, nvars, const_cast<char *>(entry)));
 }
 
+namespace {
+
+/// A function of the Std interface (runtime/Std.i) called by `CALL_Native`
+struct NativeFunction {
+  const char *name;
+  void *entry;
+  /// Variadic functions take at least `nargs` arguments
+  uint32_t nargs;
+  bool variadic;
+  /// The result of a void function is the boxed 0, as `CALL Lwrite` leaves
+  bool returnsVoid;
+  /// May trigger a collection, which may move objects
+  bool allocates;
+  /// The arguments are passed by value and nothing updates them when objects
+  /// move, so an allocating function has to root its pointer arguments itself
+  /// (`push_extra_root`) or be done with them before it allocates
+  bool keepsArguments;
+};
+
+} // namespace
+
+#define NATIVE(name, nargs)                                                    \
+  {#name, reinterpret_cast<void *>(&L##name), nargs, false, false, false, false}
+#define NATIVE_VOID(name, nargs)                                               \
+  {#name, reinterpret_cast<void *>(&L##name), nargs, false, true, false, false}
+// Only for functions checked to keep their arguments, see `keepsArguments`,
+// which goes for allocating variadic functions as well
+#define NATIVE_ALLOCATING(name, nargs)                                         \
+  {#name, reinterpret_cast<void *>(&L##name), nargs, false, false, true, true}
+#define NATIVE_VARIADIC(name, nargs, returnsVoid, allocates)                   \
+  {#name, reinterpret_cast<void *>(&L##name), nargs, true, returnsVoid,       \
+   allocates, allocates}
+
+// `enableGC` and `disableGC` are not implemented by the runtime
+static const NativeFunction nativeFunctions[] = {
+    NATIVE_VARIADIC(assert, 2, true, false),
+    NATIVE_ALLOCATING(getEnv, 1),
+    NATIVE(system, 1),
+    NATIVE(stringInt, 1),
+    NATIVE_ALLOCATING(makeArray, 1),
+    NATIVE_ALLOCATING(string, 1),
+    NATIVE(length, 1),
+    NATIVE_ALLOCATING(clone, 1),
+    NATIVE(hash, 1),
+    NATIVE(fst, 1),
+    NATIVE(snd, 1),
+    NATIVE(hd, 1),
+    NATIVE(tl, 1),
+    NATIVE_ALLOCATING(readLine, 0),
+    NATIVE_ALLOCATING(stringcat, 1),
+    NATIVE(matchSubString, 3),
+    NATIVE_ALLOCATING(substring, 3),
+    NATIVE(regexp, 1),
+    NATIVE(regexpMatch, 3),
+    NATIVE_VARIADIC(sprintf, 1, false, true),
+    NATIVE_ALLOCATING(makeString, 1),
+    NATIVE_VARIADIC(printf, 1, true, false),
+    NATIVE_VARIADIC(printfPerror, 1, true, false),
+    NATIVE_VARIADIC(fprintf, 2, true, false),
+    NATIVE(fopen, 2),
+    NATIVE_VOID(fclose, 1),
+    NATIVE_ALLOCATING(fread, 1),
+    NATIVE_VOID(fwrite, 2),
+    NATIVE(fexists, 1),
+    NATIVE_VARIADIC(failure, 1, true, false),
+    NATIVE(read, 0),
+    // `Lwrite` returns an unboxed 0
+    NATIVE_VOID(write, 1),
+    NATIVE(compare, 2),
+    NATIVE_ALLOCATING(i__Infix_4343, 2),
+    NATIVE_ALLOCATING(s__Infix_58, 2),
+    NATIVE(s__Infix_3333, 2),
+    NATIVE(s__Infix_3838, 2),
+    NATIVE(s__Infix_6161, 2),
+    NATIVE(s__Infix_3361, 2),
+    NATIVE(s__Infix_6061, 2),
+    NATIVE(s__Infix_60, 2),
+    NATIVE(s__Infix_6261, 2),
+    NATIVE(s__Infix_62, 2),
+    NATIVE(s__Infix_43, 2),
+    NATIVE(s__Infix_45, 2),
+    NATIVE(s__Infix_42, 2),
+    NATIVE(s__Infix_47, 2),
+    NATIVE(s__Infix_37, 2),
+    NATIVE(random, 1),
+    NATIVE(time, 0),
+    NATIVE(kindOf, 1),
+    NATIVE(compareTags, 2),
+    NATIVE(flatCompare, 2),
+    NATIVE(tagHash, 1),
+    NATIVE(uppercase, 1),
+    NATIVE(lowercase, 1),
+};
+
+#undef NATIVE
+#undef NATIVE_VOID
+#undef NATIVE_ALLOCATING
+#undef NATIVE_VARIADIC
+
+static constexpr size_t nativeMaxArgs = 12;
+
+// Calls `native` with the top `nargs` operands, the first argument being the
+// deepest one. The copies passed to it are not updated if a collection moves
+// objects during the call, allocating natives take care of their arguments
+// themselves (`NativeFunction::keepsArguments`)
+static Value callNative(const NativeFunction &native, size_t nargs) {
+  Value args[nativeMaxArgs] = {};
+  for (size_t i = 0; i < nargs; ++i) {
+    args[i] = Stack::top()[nargs - i];
+  }
+  // Every entry is called with `nativeMaxArgs` words: under cdecl the caller
+  // pops the arguments, so the unused ones are harmless, and variadic
+  // functions read theirs from the stack as if they were passed separately
+  using Entry = Value (*)(Value, Value, Value, Value, Value, Value, Value,
+                          Value, Value, Value, Value, Value);
+  auto entry = reinterpret_cast<Entry>(native.entry);
+  Value result = entry(args[0], args[1], args[2], args[3], args[4], args[5],
+                       args[6], args[7], args[8], args[9], args[10], args[11]);
+  return native.returnsVoid ? boxInt(0) : result;
+}
+
+// Length of the instruction at `ip` in bytes, 0 if it is unknown or truncated
+static size_t instructionLength(const char *ip, const char *end) {
+  size_t length = 0;
+  switch (static_cast<unsigned char>(*ip)) {
+  case I_BINOP_Add:
+  case I_BINOP_Sub:
+  case I_BINOP_Mul:
+  case I_BINOP_Div:
+  case I_BINOP_Mod:
+  case I_BINOP_Lt:
+  case I_BINOP_Leq:
+  case I_BINOP_Gt:
+  case I_BINOP_Geq:
+  case I_BINOP_Eq:
+  case I_BINOP_Neq:
+  case I_BINOP_And:
+  case I_BINOP_Or:
+  case I_STA:
+  case I_END:
+  case I_DROP:
+  case I_DUP:
+  case I_ELEM:
+  case I_PATT_StrCmp:
+  case I_PATT_String:
+  case I_PATT_Array:
+  case I_PATT_Sexp:
+  case I_PATT_Boxed:
+  case I_PATT_UnBoxed:
+  case I_PATT_Closure:
+  case I_CALL_Lread:
+  case I_CALL_Lwrite:
+  case I_CALL_Llength:
+  case I_CALL_Lstring:
+    length = 1;
+    break;
+  case I_CONST:
+  case I_STRING:
+  case I_JMP:
+  case I_LD_Global:
+  case I_LD_Local:
+  case I_LD_Arg:
+  case I_LD_Access:
+  case I_LDA_Global:
+  case I_LDA_Local:
+  case I_LDA_Arg:
+  case I_LDA_Access:
+  case I_ST_Global:
+  case I_ST_Local:
+  case I_ST_Arg:
+  case I_ST_Access:
+  case I_CJMPz:
+  case I_CJMPnz:
+  case I_CALLC:
+  case I_ARRAY:
+  case I_LINE:
+  case I_CASE_Switch:
+  case I_CALL_Barray:
+    length = 5;
+    break;
+  case I_SEXP:
+  case I_BEGIN:
+  case I_BEGINcl:
+  case I_CALL:
+  case I_TAG:
+  case I_FAIL:
+  case I_CALL_Native:
+    length = 9;
+    break;
+  case I_CLOSURE: {
+    if (end - ip < 9)
+      return 0;
+    int32_t n;
+    memcpy(&n, ip + 5, sizeof(int32_t));
+    if (n < 0 || n > (end - ip - 9) / 5)
+      return 0;
+    length = 9 + 5 * n;
+    break;
+  }
+  }
+  return length <= static_cast<size_t>(end - ip) ? length : 0;
+}
+
+static int32_t wordAt(const char *ip) {
+  int32_t word;
+  memcpy(&word, ip, sizeof(int32_t));
+  return word;
+}
+
+namespace {
+
+/// One test of a `case` as lamac compiles it: `DUP; <test>; CJMPz failure`,
+/// where the test is `TAG`, `ARRAY` or a kind test `PATT_*` other than
+/// `PATT_StrCmp`. It leaves the operand stack as it was, and continues after
+/// the `CJMPz` if the top operand matches or at `failure` otherwise
+struct PatternTest {
+  unsigned char code;
+  /// Unboxed tag hash for `TAG`
+  int32_t tag;
+  /// Number of fields for `TAG` and `ARRAY`
+  int32_t length;
+  size_t success;
+  size_t failure;
+};
+
+/// A decision node replacing a chain of `PatternTest`s, each jumping to the
+/// next one on failure: one look at the header of the top operand finds the
+/// first test it passes, whatever the number of tests
+class CaseSwitch {
+public:
+  /// `tests` in the order of the chain, the last one fails to `failure`
+  CaseSwitch(const std::vector<PatternTest> &tests, const char *code);
+
+  const char *dispatch(Value value) const;
+
+private:
+  // Valid headers have odd tags, anything else only passes `PATT_Boxed`
+  static size_t kindIndex(int kind) { return kind & 1 ? kind >> 1 : 5; }
+
+  void matchKind(int kind, const char *target);
+
+private:
+  /// Where values of each kind go unless one of the maps says otherwise,
+  /// indexed by `kindIndex` of `STRING_TAG` ... `UNBOXED_TAG` and other
+  /// boxed values
+  std::array<const char *, 6> byKind;
+  /// Sexps by tag and number of fields
+  std::unordered_map<uint64_t, const char *> sexps;
+  /// Arrays by length
+  std::unordered_map<int32_t, const char *> arrays;
+};
+
+} // namespace
+
+static uint64_t sexpKey(int32_t tag, int32_t length) {
+  return static_cast<uint64_t>(static_cast<uint32_t>(tag)) << 32 |
+         static_cast<uint32_t>(length);
+}
+
+CaseSwitch::CaseSwitch(const std::vector<PatternTest> &tests,
+                       const char *code) {
+  byKind.fill(code + tests.back().failure);
+  // Going from the last test to the first, so that earlier tests take over
+  for (auto test = tests.rbegin(); test != tests.rend(); ++test) {
+    const char *target = code + test->success;
+    switch (test->code) {
+    case I_TAG:
+      sexps[sexpKey(test->tag, test->length)] = target;
+      break;
+    case I_ARRAY:
+      arrays[test->length] = target;
+      break;
+    case I_PATT_String:
+      matchKind(STRING_TAG, target);
+      break;
+    case I_PATT_Array:
+      matchKind(ARRAY_TAG, target);
+      break;
+    case I_PATT_Sexp:
+      matchKind(SEXP_TAG, target);
+      break;
+    case I_PATT_Closure:
+      matchKind(CLOSURE_TAG, target);
+      break;
+    case I_PATT_UnBoxed:
+      matchKind(UNBOXED_TAG, target);
+      break;
+    case I_PATT_Boxed:
+      for (int kind : {STRING_TAG, ARRAY_TAG, SEXP_TAG, CLOSURE_TAG, 0}) {
+        matchKind(kind, target);
+      }
+      break;
+    }
+  }
+}
+
+void CaseSwitch::matchKind(int kind, const char *target) {
+  // Tests following this one are never reached by values of this kind
+  byKind[kindIndex(kind)] = target;
+  if (kind == SEXP_TAG) {
+    sexps.clear();
+  } else if (kind == ARRAY_TAG) {
+    arrays.clear();
+  }
+}
+
+const char *CaseSwitch::dispatch(Value value) const {
+  if (valueIsInt(value))
+    return byKind[kindIndex(UNBOXED_TAG)];
+  int header = headerOf(value);
+  int kind = TAG(header);
+  if (kind == SEXP_TAG && !sexps.empty()) {
+    auto found = sexps.find(sexpKey(TO_SEXP(value)->tag, LEN(header)));
+    if (found != sexps.end())
+      return found->second;
+  } else if (kind == ARRAY_TAG && !arrays.empty()) {
+    auto found = arrays.find(LEN(header));
+    if (found != arrays.end())
+      return found->second;
+  }
+  return byKind[kindIndex(kind)];
+}
+
 static const char unknownFile[] = "<unknown file>";
 
 namespace {
@@ -331,13 +819,39 @@ private:
   char readByte();
   int32_t readWord();
 
+  // Attributes allocations to the instruction whose opcode was just read
+  void noteAllocationSite() {
+    gc_alloc_site = instructionPointer - 1 - byteFile.getCode();
+  }
+
   Value &accessVar(char designation, int32_t index);
 
+  const NativeFunction &resolveNative(uint32_t nameOffset, uint32_t nargs);
+
+  // Pushes the boxed result of a pattern test, unless a conditional jump
+  // follows: then it is taken right away
+  void pushTestResult(bool result);
+
+  /// Unboxed `LtagHash` of the string at `stringOffset`
+  int32_t tagHashAt(uint32_t stringOffset);
+
+  // Replaces pattern test chains in the code with `CASE_Switch` instructions
+  void compileCaseSwitches();
+  bool decodePatternTest(size_t offset, PatternTest &test);
+
 private:
   ByteFile byteFile;
 
   const char *instructionPointer;
   const char *codeEnd;
+
+  /// Natives resolved so far, by the string table offset of their name
+  std::vector<const NativeFunction *> resolvedNatives;
+
+  /// Boxed tag hashes by string table offset, 0 until computed
+  std::vector<Value> tagHashes;
+
+  std::vector<CaseSwitch> caseSwitches;
 } interpreter;
 
 } // namespace
@@ -345,9 +859,124 @@ private:
 Interpreter::Interpreter(ByteFile byteFile)
     : byteFile(std::move(byteFile)),
       instructionPointer(this->byteFile.getCode()),
-      codeEnd(instructionPointer + this->byteFile.getCodeSizeBytes()) {}
+      codeEnd(instructionPointer + this->byteFile.getCodeSizeBytes()),
+      resolvedNatives(this->byteFile.getStringTableSizeBytes()),
+      tagHashes(this->byteFile.getStringTableSizeBytes()) {
+  compileCaseSwitches();
+}
+
+// Chains longer than this are split into several nodes, which bounds the size
+// of a node
+static constexpr size_t caseSwitchMaxTests = 256;
+
+void Interpreter::compileCaseSwitches() {
+  const char *code = byteFile.getCode();
+  size_t codeSize = byteFile.getCodeSizeBytes();
+
+  // Instructions are only replaced if no jump leads into the replaced bytes,
+  // which needs every instruction to be decoded
+  std::vector<size_t> starts;
+  std::unordered_set<size_t> targets;
+  for (size_t offset = 0; offset < codeSize;) {
+    size_t length = instructionLength(code + offset, code + codeSize);
+    if (length == 0)
+      return;
+    starts.push_back(offset);
+    switch (static_cast<unsigned char>(code[offset])) {
+    case I_JMP:
+    case I_CJMPz:
+    case I_CJMPnz:
+    case I_CLOSURE:
+    case I_CALL:
+      targets.insert(wordAt(code + offset + 1));
+      break;
+    }
+    offset += length;
+  }
+
+  std::vector<PatternTest> tests;
+  std::vector<size_t> testOffsets;
+  std::unordered_set<size_t> visited;
+  // Tests past the head of a replaced chain, only reached through its node
+  std::unordered_set<size_t> covered;
+  for (size_t head : starts) {
+    if (covered.count(head))
+      continue;
+    tests.clear();
+    testOffsets.clear();
+    visited.clear();
+    PatternTest test;
+    for (size_t offset = head; tests.size() < caseSwitchMaxTests &&
+                               visited.insert(offset).second &&
+                               decodePatternTest(offset, test);) {
+      tests.push_back(test);
+      testOffsets.push_back(offset);
+      // Failed tests are followed by the next one, maybe after line numbers
+      offset = test.failure;
+      while (offset + 5 <= codeSize && code[offset] == I_LINE) {
+        offset += 5;
+      }
+    }
+    if (tests.size() < 2)
+      continue;
+    std::array<char, 5> instruction;
+    if (std::any_of(targets.begin(), targets.end(), [&](size_t target) {
+          return target > head && target < head + instruction.size();
+        }))
+      continue;
+    int32_t index = caseSwitches.size();
+    caseSwitches.emplace_back(tests, code);
+    instruction[0] = I_CASE_Switch;
+    memcpy(&instruction[1], &index, sizeof(int32_t));
+    byteFile.patchCode(head, instruction.data(), instruction.size());
+    covered.insert(testOffsets.begin() + 1, testOffsets.end());
+  }
+}
+
+bool Interpreter::decodePatternTest(size_t offset, PatternTest &test) {
+  const char *code = byteFile.getCode();
+  const char *end = code + byteFile.getCodeSizeBytes();
+  const char *ip = code + offset;
+  if (offset >= byteFile.getCodeSizeBytes() || *ip != I_DUP)
+    return false;
+  ip += 1;
+  size_t length = instructionLength(ip, end);
+  if (length == 0)
+    return false;
+  test.code = *ip;
+  switch (test.code) {
+  case I_TAG: {
+    size_t stringOffset = wordAt(ip + 1);
+    if (stringOffset >= byteFile.getStringTableSizeBytes())
+      return false;
+    test.tag = tagHashAt(stringOffset);
+    test.length = wordAt(ip + 5);
+    break;
+  }
+  case I_ARRAY:
+    test.length = wordAt(ip + 1);
+    break;
+  case I_PATT_String:
+  case I_PATT_Array:
+  case I_PATT_Sexp:
+  case I_PATT_Boxed:
+  case I_PATT_UnBoxed:
+  case I_PATT_Closure:
+    break;
+  default:
+    return false;
+  }
+  ip += length;
+  if (ip == end || instructionLength(ip, end) == 0 || *ip != I_CJMPz)
+    return false;
+  test.failure = static_cast<uint32_t>(wordAt(ip + 1));
+  test.success = ip + 5 - code;
+  return test.failure < byteFile.getCodeSizeBytes() &&
+         test.success < byteFile.getCodeSizeBytes();
+}
 
 void Interpreter::run() {
+  gc_census_code_base = (size_t)byteFile.getCode();
   __gc_init();
   Stack::init();
   while (true) {
@@ -434,6 +1063,7 @@ bool Interpreter::step() {
     return true;
   }
   case I_STRING: {
+    noteAllocationSite();
     uint32_t offset = readWord();
     const char *cstr = byteFile.getStringAt(offset);
     Value string = createString(cstr);
@@ -441,6 +1071,7 @@ bool Interpreter::step() {
     return true;
   }
   case I_SEXP: {
+    noteAllocationSite();
     Value stringOffset = readWord();
     uint32_t nargs = readWord();
     if (Stack::getOperandStackSize() < nargs) {
@@ -468,10 +1099,14 @@ bool Interpreter::step() {
     Value value = Stack::popOperand();
     Value index = Stack::popOperand();
     Value container = Stack::popOperand();
-    Value result =
-        reinterpret_cast<Value>(Bsta(reinterpret_cast<void *>(value), index,
-                                     reinterpret_cast<void *>(container)));
-    Stack::pushOperand(result);
+    if (!valueIsInt(index)) {
+      Stack::noteWrite(reinterpret_cast<Value *>(container));
+    }
+    if (!storeElement(container, index, value)) {
+      Bsta(reinterpret_cast<void *>(value), index,
+           reinterpret_cast<void *>(container));
+    }
+    Stack::pushOperand(value);
     return true;
   }
   case I_JMP: {
@@ -497,8 +1132,11 @@ bool Interpreter::step() {
   case I_ELEM: {
     Value index = Stack::popOperand();
     Value container = Stack::popOperand();
-    Value element = reinterpret_cast<Value>(
-        Belem(reinterpret_cast<void *>(container), index));
+    Value element;
+    if (!loadElement(container, index, element)) {
+      element = reinterpret_cast<Value>(
+          Belem(reinterpret_cast<void *>(container), index));
+    }
     Stack::pushOperand(element);
     return true;
   }
@@ -528,6 +1166,10 @@ bool Interpreter::step() {
     int32_t index = readWord();
     Value &var = accessVar(low, index);
     Value operand = Stack::peakOperand();
+    // Captured variables live in the closure object, i.e. in the heap
+    if (low == LOC_Access && gc_marking_in_progress) {
+      gc_satb_record(reinterpret_cast<void *>(var));
+    }
     var = operand;
     return true;
   }
@@ -548,6 +1190,7 @@ bool Interpreter::step() {
     return true;
   }
   case I_CLOSURE: {
+    noteAllocationSite();
     uint32_t entryOffset = readWord();
     uint32_t n = readWord();
 
@@ -593,20 +1236,13 @@ bool Interpreter::step() {
   case I_TAG: {
     uint32_t stringOffset = readWord();
     uint32_t nargs = readWord();
-    const char *string = byteFile.getStringAt(stringOffset);
-    Value tag = LtagHash(const_cast<char *>(string));
-    Value target = Stack::popOperand();
-
-    Value result = Btag((void *)target, tag, boxInt(nargs));
-
-    Stack::pushOperand(result);
+    int32_t tag = tagHashAt(stringOffset);
+    pushTestResult(isSexp(Stack::popOperand(), tag, nargs));
     return true;
   }
   case I_ARRAY: {
     uint32_t nelems = readWord();
-    Value array = Stack::popOperand();
-    Value result = Barray_patt(reinterpret_cast<void *>(array), boxInt(nelems));
-    Stack::pushOperand(result);
+    pushTestResult(isArray(Stack::popOperand(), nelems));
     return true;
   }
   case I_FAIL: {
@@ -620,48 +1256,39 @@ bool Interpreter::step() {
     readWord();
     return true;
   }
+  case I_CASE_Switch: {
+    const CaseSwitch &node = caseSwitches[readWord()];
+    instructionPointer = node.dispatch(Stack::peakOperand());
+    return true;
+  }
   case I_PATT_StrCmp: {
     Value x = Stack::popOperand();
     Value y = Stack::popOperand();
-    Value result =
-        Bstring_patt(reinterpret_cast<void *>(x), reinterpret_cast<void *>(y));
-    Stack::pushOperand(result);
+    pushTestResult(isEqualString(x, y));
     return true;
   }
   case I_PATT_String: {
-    Value operand = Stack::popOperand();
-    Value result = Bstring_tag_patt(reinterpret_cast<void *>(operand));
-    Stack::pushOperand(result);
+    pushTestResult(hasKind(Stack::popOperand(), STRING_TAG));
     return true;
   }
   case I_PATT_Array: {
-    Value operand = Stack::popOperand();
-    Value result = Barray_tag_patt(reinterpret_cast<void *>(operand));
-    Stack::pushOperand(result);
+    pushTestResult(hasKind(Stack::popOperand(), ARRAY_TAG));
     return true;
   }
   case I_PATT_Sexp: {
-    Value operand = Stack::popOperand();
-    Value result = Bsexp_tag_patt(reinterpret_cast<void *>(operand));
-    Stack::pushOperand(result);
+    pushTestResult(hasKind(Stack::popOperand(), SEXP_TAG));
     return true;
   }
   case I_PATT_Boxed: {
-    Value operand = Stack::popOperand();
-    Value result = Bboxed_patt(reinterpret_cast<void *>(operand));
-    Stack::pushOperand(result);
+    pushTestResult(valueIsPtr(Stack::popOperand()));
     return true;
   }
   case I_PATT_UnBoxed: {
-    Value operand = Stack::popOperand();
-    Value result = Bunboxed_patt(reinterpret_cast<void *>(operand));
-    Stack::pushOperand(result);
+    pushTestResult(valueIsInt(Stack::popOperand()));
     return true;
   }
   case I_PATT_Closure: {
-    Value operand = Stack::popOperand();
-    Value result = Bclosure_tag_patt(reinterpret_cast<void *>(operand));
-    Stack::pushOperand(result);
+    pushTestResult(hasKind(Stack::popOperand(), CLOSURE_TAG));
     return true;
   }
   case I_CALL_Lread: {
@@ -680,12 +1307,14 @@ bool Interpreter::step() {
     return true;
   }
   case I_CALL_Lstring: {
+    noteAllocationSite();
     Value operand = Stack::popOperand();
     Value rendered = renderToString(operand);
     Stack::pushOperand(rendered);
     return true;
   }
   case I_CALL_Barray: {
+    noteAllocationSite();
     uint32_t nargs = readWord();
     if (Stack::getOperandStackSize() < nargs) {
       runtimeError("cannot construct array of {} elements: operand stack "
@@ -698,10 +1327,47 @@ bool Interpreter::step() {
     Stack::pushOperand(array);
     return true;
   }
+  case I_CALL_Native: {
+    uint32_t nameOffset = readWord();
+    uint32_t nargs = readWord();
+    const NativeFunction &native = resolveNative(nameOffset, nargs);
+    if (Stack::getOperandStackSize() < nargs) {
+      runtimeError("cannot call {} with {} arguments: operand stack size is "
+                   "only {}",
+                   native.name, nargs, Stack::getOperandStackSize());
+    }
+    if (native.allocates) {
+      noteAllocationSite();
+    }
+    Value result = callNative(native, nargs);
+    Stack::popNOperands(nargs);
+    Stack::pushOperand(result);
+    return true;
+  }
   }
   runtimeError("unsupported instruction code {:#04x}", byte);
 }
 
+void Interpreter::pushTestResult(bool result) {
+  if (instructionPointer < codeEnd && (*instructionPointer == I_CJMPz ||
+                                       *instructionPointer == I_CJMPnz)) {
+    bool jumpIf = *instructionPointer++ == I_CJMPnz;
+    uint32_t offset = readWord();
+    if (result == jumpIf)
+      instructionPointer = byteFile.getAddressFor(offset);
+    return;
+  }
+  Stack::pushIntOperand(result);
+}
+
+int32_t Interpreter::tagHashAt(uint32_t stringOffset) {
+  if (stringOffset >= tagHashes.size() || tagHashes[stringOffset] == 0) {
+    const char *name = byteFile.getStringAt(stringOffset);
+    tagHashes[stringOffset] = LtagHash(const_cast<char *>(name));
+  }
+  return unboxInt(tagHashes[stringOffset]);
+}
+
 char Interpreter::readByte() {
   if (instructionPointer > codeEnd - 1)
     runtimeError("unexpected end of bytecode, expected a byte");
@@ -732,6 +1398,32 @@ Value &Interpreter::accessVar(char designation, int32_t index) {
   runtimeError("unsupported variable designation {:#x}", designation);
 }
 
+const NativeFunction &Interpreter::resolveNative(uint32_t nameOffset,
+                                                 uint32_t nargs) {
+  const char *name = byteFile.getStringAt(nameOffset);
+  const NativeFunction *&native = resolvedNatives[nameOffset];
+  if (native == nullptr) {
+    auto found = std::find_if(
+        std::begin(nativeFunctions), std::end(nativeFunctions),
+        [name](const NativeFunction &f) { return strcmp(f.name, name) == 0; });
+    if (found == std::end(nativeFunctions)) {
+      runtimeError("unknown native function {}", name);
+    }
+    native = found;
+  }
+  if (nargs < native->nargs || (!native->variadic && nargs != native->nargs)) {
+    runtimeError("native function {} takes {}{} arguments, got {}", name,
+                 native->variadic ? "at least " : "", native->nargs, nargs);
+  }
+  if (nargs > nativeMaxArgs) {
+    runtimeError("native function {} called with {} arguments, at most {} "
+                 "are supported",
+                 name, nargs, nativeMaxArgs);
+  }
+  assert(!native->allocates || native->keepsArguments);
+  return *native;
+}
+
 void lama::interpret(ByteFile byteFile) {
   initGlobalArea();
   interpreter = Interpreter(std::move(byteFile));
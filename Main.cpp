@@ -4,6 +4,8 @@
 
 using namespace lama;
 
+extern "C" void flush_write_buffer();
+
 int main(int argc, const char **argv) {
   if (argc != 2) {
     std::cerr << "Please provide one argument: path to bytecode file"
@@ -15,6 +17,7 @@ int main(int argc, const char **argv) {
     ByteFile byteFile = ByteFile::load(byteFilePath);
     interpret(std::move(byteFile));
   } catch (std::runtime_error &error) {
+    flush_write_buffer();
     std::cerr << error.what() << std::endl;
     return -1;
   }
@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+"""Assembles a bytecode listing into a bytefile that YAILama can run.
+
+lamac does not emit every instruction the interpreter knows (`CALL_Native`),
+so those are tested with programs written by hand. A listing has one
+instruction per line, named as in `InstCode` of Interpreter.cpp without the
+`I_` prefix (all but `CLOSURE`), with integer, label or "string" operands. A string operand is
+the offset of the string in the string table. Lines `name:` define labels,
+`;` starts a comment. The code starts at offset 0 and is exported as `main`.
+"""
+
+import shlex
+import struct
+import sys
+
+OPCODES = {
+    'BINOP_Add': 0x01, 'BINOP_Sub': 0x02, 'BINOP_Mul': 0x03,
+    'BINOP_Div': 0x04, 'BINOP_Mod': 0x05, 'BINOP_Lt': 0x06,
+    'BINOP_Leq': 0x07, 'BINOP_Gt': 0x08, 'BINOP_Geq': 0x09,
+    'BINOP_Eq': 0x0a, 'BINOP_Neq': 0x0b, 'BINOP_And': 0x0c,
+    'BINOP_Or': 0x0d,
+    'CONST': 0x10, 'STRING': 0x11, 'SEXP': 0x12, 'STA': 0x14, 'JMP': 0x15,
+    'END': 0x16, 'DROP': 0x18, 'DUP': 0x19, 'ELEM': 0x1b,
+    'LD_Global': 0x20, 'LD_Local': 0x21, 'LD_Arg': 0x22, 'LD_Access': 0x23,
+    'LDA_Global': 0x30, 'LDA_Local': 0x31, 'LDA_Arg': 0x32,
+    'LDA_Access': 0x33,
+    'ST_Global': 0x40, 'ST_Local': 0x41, 'ST_Arg': 0x42, 'ST_Access': 0x43,
+    'CJMPz': 0x50, 'CJMPnz': 0x51, 'BEGIN': 0x52, 'BEGINcl': 0x53,
+    'CALLC': 0x55, 'CALL': 0x56, 'TAG': 0x57, 'ARRAY': 0x58, 'FAIL': 0x59,
+    'LINE': 0x5a,
+    'PATT_StrCmp': 0x60, 'PATT_String': 0x61, 'PATT_Array': 0x62,
+    'PATT_Sexp': 0x63, 'PATT_Boxed': 0x64, 'PATT_UnBoxed': 0x65,
+    'PATT_Closure': 0x66,
+    'CALL_Lread': 0x70, 'CALL_Lwrite': 0x71, 'CALL_Llength': 0x72,
+    'CALL_Lstring': 0x73, 'CALL_Barray': 0x74, 'CALL_Native': 0x75,
+}
+
+
+def assemble(lines):
+    strings = {}
+    table = bytearray()
+
+    def string_offset(string):
+        if string not in strings:
+            strings[string] = len(table)
+            table.extend(string.encode() + b'\0')
+        return strings[string]
+
+    string_offset('main')
+    instructions = []
+    labels = {}
+    offset = 0
+    for number, line in enumerate(lines, 1):
+        lexer = shlex.shlex(line, posix=False)
+        lexer.commenters = ';'
+        lexer.whitespace_split = True
+        words = list(lexer)
+        if not words:
+            continue
+        if len(words) == 1 and words[0].endswith(':'):
+            labels[words[0][:-1]] = offset
+            continue
+        if words[0] not in OPCODES:
+            sys.exit(f'line {number}: unknown instruction {words[0]}')
+        instructions.append((number, words))
+        offset += 1 + 4 * (len(words) - 1)
+
+    code = bytearray()
+    for number, words in instructions:
+        code.append(OPCODES[words[0]])
+        for operand in words[1:]:
+            if operand.startswith('"'):
+                value = string_offset(
+                    operand[1:-1].encode().decode('unicode_escape'))
+            elif operand in labels:
+                value = labels[operand]
+            else:
+                try:
+                    value = int(operand, 0)
+                except ValueError:
+                    sys.exit(f'line {number}: unknown label {operand}')
+            code.extend(struct.pack('<i', value))
+
+    header = struct.pack('<iiiii', len(table), 0, 1, string_offset('main'), 0)
+    return header + table + code
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        sys.exit(f'usage: {sys.argv[0]} listing bytefile')
+    with open(sys.argv[1]) as listing:
+        bytefile = assemble(listing.readlines())
+    with open(sys.argv[2], 'wb') as output:
+        output.write(bytefile)
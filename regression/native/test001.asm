@@ -0,0 +1,36 @@
+; Fixed-arity allocating natives, with collections in the middle of the calls:
+; s := substring (s ++ s, 1, 8) rotates s by one character, so after 1000003
+; iterations s is rotated by 3. Then a variadic void native, which leaves 0
+    BEGIN 2 2
+    STRING "abcdefgh"
+    ST_Local 0
+    DROP
+    CONST 0
+    ST_Local 1
+    DROP
+loop:
+    LD_Local 1
+    CONST 1000003
+    BINOP_Lt
+    CJMPz done
+    LD_Local 0
+    LD_Local 0
+    CALL_Native "i__Infix_4343" 2
+    CONST 1
+    CONST 8
+    CALL_Native "substring" 3
+    ST_Local 0
+    DROP
+    LD_Local 1
+    CONST 1
+    BINOP_Add
+    ST_Local 1
+    DROP
+    JMP loop
+done:
+    STRING "%s %d\n"
+    LD_Local 0
+    LD_Local 1
+    CALL_Native "printf" 3
+    CALL_Lwrite
+    END
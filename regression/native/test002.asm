@@ -0,0 +1,37 @@
+; A variadic allocating native called in a loop, so that it collects too,
+; then `write` and `length`
+    BEGIN 2 2
+    STRING ""
+    ST_Local 0
+    DROP
+    CONST 0
+    ST_Local 1
+    DROP
+loop:
+    LD_Local 1
+    CONST 300000
+    BINOP_Lt
+    CJMPz done
+    STRING "%s:%d-%d"
+    STRING "x"
+    LD_Local 1
+    CONST 7
+    CALL_Native "sprintf" 4
+    ST_Local 0
+    DROP
+    LD_Local 1
+    CONST 1
+    BINOP_Add
+    ST_Local 1
+    DROP
+    JMP loop
+done:
+    STRING "%s\n"
+    LD_Local 0
+    CALL_Native "printf" 2
+    DROP
+    LD_Local 0
+    CALL_Native "length" 1
+    CALL_Native "write" 1
+    CALL_Lwrite
+    END
@@ -0,0 +1,5 @@
+; A name that is not in the native table
+    BEGIN 2 0
+    CONST 1
+    CALL_Native "noSuchFunction" 1
+    END
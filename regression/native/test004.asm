@@ -0,0 +1,6 @@
+; A fixed-arity native with a missing argument
+    BEGIN 2 0
+    STRING "abc"
+    CONST 0
+    CALL_Native "substring" 2
+    END
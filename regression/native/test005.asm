@@ -0,0 +1,4 @@
+; A variadic native without its format
+    BEGIN 2 0
+    CALL_Native "sprintf" 0
+    END
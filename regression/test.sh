@@ -1,4 +1,5 @@
 make check
 pushd expressions && make check && popd
 pushd deep-expressions && make check && popd
+pushd native && make check && popd
 pushd x86only && make check && popd
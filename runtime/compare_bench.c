@@ -0,0 +1,160 @@
+// Microbenchmarks of `Lcompare` against the recursive implementation it replaced, which is kept
+// here as the reference; every case also checks that both give the same result. Values are rooted
+// with `push_extra_root`, the Lama stack is empty
+
+#include "gc.h"
+#include "runtime_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+extern int   Lcompare (void *p, void *q);
+extern int   LtagHash (char *s);
+extern void *LmakeArray (int length);
+extern void *LmakeString (int length);
+
+static int reference_compare (void *p, void *q) {
+#define COMPARE_AND_RETURN(x, y)                                                                   \
+  do                                                                                               \
+    if (x != y) return BOX(x - y);                                                                 \
+  while (0)
+
+  if (p == q) return BOX(0);
+
+  if (UNBOXED(p)) {
+    if (UNBOXED(q)) return BOX(UNBOX(p) - UNBOX(q));
+    else return BOX(-1);
+  } else if (UNBOXED(q)) return BOX(1);
+  else {
+    if (is_runtime_object(p)) {
+      if (is_runtime_object(q)) {
+        data *a = TO_DATA(p), *b = TO_DATA(q);
+        int   ta = TAG(a->data_header), tb = TAG(b->data_header);
+        int   la = LEN(a->data_header), lb = LEN(b->data_header);
+        int   i;
+        int   shift = 0;
+
+        COMPARE_AND_RETURN(ta, tb);
+
+        switch (ta) {
+          case STRING_TAG: return BOX(strcmp(a->contents, b->contents));
+
+          case CLOSURE_TAG:
+            COMPARE_AND_RETURN(((void **)a->contents)[0], ((void **)b->contents)[0]);
+            COMPARE_AND_RETURN(la, lb);
+            i = 1;
+            break;
+
+          case ARRAY_TAG:
+            COMPARE_AND_RETURN(la, lb);
+            i = 0;
+            break;
+
+          case SEXP_TAG: {
+            int tag_a = TO_SEXP(p)->tag, tag_b = TO_SEXP(q)->tag;
+            COMPARE_AND_RETURN(tag_a, tag_b);
+            COMPARE_AND_RETURN(la, lb);
+            i     = 0;
+            shift = 1;
+            break;
+          }
+
+          default: abort();
+        }
+
+        for (; i < la; i++) {
+          int c = reference_compare(((void **)a->contents)[i + shift],
+                                    ((void **)b->contents)[i + shift]);
+          if (c != BOX(0)) return c;
+        }
+        return BOX(0);
+      } else return BOX(-1);
+    } else if (is_runtime_object(q)) return BOX(1);
+    else return BOX(p - q);
+  }
+#undef COMPARE_AND_RETURN
+}
+
+static double seconds (void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void bench (const char *name, void *p, void *q, int repetitions) {
+  int expected = reference_compare(p, q), actual = Lcompare(p, q);
+  if (expected != actual) {
+    fprintf(stderr, "ERROR: %s: compare gives %d instead of %d\n", name, actual, expected);
+    exit(1);
+  }
+  double start = seconds();
+  for (int i = 0; i < repetitions; ++i) { reference_compare(p, q); }
+  double recursive = seconds() - start;
+  start            = seconds();
+  for (int i = 0; i < repetitions; ++i) { Lcompare(p, q); }
+  double current = seconds() - start;
+  printf("%-24s recursive %10.0f ns   current %10.0f ns   x%.2f\n",
+         name,
+         recursive * 1e9 / repetitions,
+         current * 1e9 / repetitions,
+         recursive / current);
+}
+
+// both arrays hold 0, 1, ..., n - 1 but the last element of `b` is `last`
+static void make_int_arrays (void **a, void **b, int n, int last) {
+  *a = LmakeArray(BOX(n));
+  *b = LmakeArray(BOX(n));
+  for (int i = 0; i < n; ++i) { ((int *)*a)[i] = ((int *)*b)[i] = BOX(i); }
+  ((int *)*b)[n - 1] = BOX(last);
+}
+
+static void make_strings (void **a, void **b, int n) {
+  *a = LmakeString(BOX(n));
+  *b = LmakeString(BOX(n));
+  memset(*a, 'x', n);
+  memset(*b, 'x', n);
+  ((char *)*b)[n - 1] = 'y';
+}
+
+// a list of 0, 1, ..., n - 1 ending with `last`
+static void *make_list (int n, int last) {
+  void *list = (void *)BOX(0);
+  push_extra_root(&list);
+  for (int i = n - 1; i >= 0; --i) {
+    data *cell                 = alloc_sexp(2);
+    ((sexp *)cell)->tag        = UNBOX(LtagHash("cons"));
+    ((int *)cell->contents)[1] = BOX(i == n - 1 ? last : i);
+    ((int *)cell->contents)[2] = (int)list;
+    list                       = cell->contents;
+  }
+  pop_extra_root(&list);
+  return list;
+}
+
+int main (void) {
+  __init();
+  void *a = NULL, *b = NULL;
+  push_extra_root(&a);
+  push_extra_root(&b);
+
+  make_int_arrays(&a, &b, 16, 100);
+  bench("short int arrays", a, b, 1000000);
+  make_int_arrays(&a, &b, 8000, 8000);
+  bench("long int arrays", a, b, 20000);
+
+  make_strings(&a, &b, 16);
+  bench("short strings", a, b, 1000000);
+  make_strings(&a, &b, 30000);
+  bench("long strings", a, b, 20000);
+
+  a = make_list(10000, 10000);
+  b = make_list(10000, 10001);
+  bench("lists", a, b, 1000);
+
+  pop_extra_root(&b);
+  pop_extra_root(&a);
+  __shutdown();
+  return 0;
+}
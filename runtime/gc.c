@@ -6,7 +6,9 @@
 
 #include <assert.h>
 #include <execinfo.h>
+#include <limits.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,6 +18,27 @@
 
 static const size_t INIT_HEAP_SIZE = MINIMUM_HEAP_CAPACITY;
 
+#define BITS_PER_WORD (sizeof(size_t) * 8)
+#define MARK_STACK_INITIAL_CAPACITY 1024
+// number of objects which are taken off the mark stack and prefetched before they are scanned
+#define MARK_PREFETCH_WINDOW 8
+
+static gc_mode mode       = GC_MODE_LISP2;
+static bool    huge_pages = false;
+
+static gc_stats              stats;
+static const char           *stats_path           = NULL;
+static volatile sig_atomic_t stats_dump_requested = 0;
+
+size_t                       gc_census_code_base = 0;
+static heap_census           census;
+static const char           *census_path           = NULL;
+static volatile sig_atomic_t census_dump_requested = 0;
+
+static void   gc_stats_dump_to_path (void);
+static void   gc_heap_census_dump_to_path (void);
+static size_t huge_pages_kb (const void *addr);
+
 #ifdef DEBUG_VERSION
 size_t cur_id = 0;
 #endif
@@ -23,6 +46,7 @@ size_t cur_id = 0;
 static extra_roots_pool extra_roots;
 
 size_t __gc_stack_top = 0, __gc_stack_bottom = 0;
+size_t __gc_stack_watermark = 0, __gc_stack_frame_limit = 0;
 #ifdef LAMA_ENV
 extern const size_t __start_custom_data, __stop_custom_data;
 #endif
@@ -32,11 +56,150 @@ memory_chunk heap;
 #else
 static memory_chunk heap;
 #endif
+// pointer-free space of LISP2 heap, empty with other collectors
+static memory_chunk pointer_free;
+// words needed in the pointer-free space by the allocation which triggered the collection
+static size_t       pointer_free_request;
 
 #ifdef DEBUG_VERSION
 void dump_heap ();
 #endif
 
+// growable LIFO of pointers, used by collectors which can't thread their worklist through the heap
+typedef struct {
+  void **data;
+  size_t size;
+  size_t capacity;
+} mark_stack;
+
+// addresses of Lama stack slots holding heap pointers, found by the last stack scan, in decreasing order
+static mark_stack stack_slots;
+// stack bottom at the time of the last stack scan, NULL if recorded slots can't be reused
+static size_t    *stack_slots_bottom = NULL;
+
+typedef struct {
+  size_t          used_blocks;   // blocks [0, used_blocks) have been handed out at least once
+  size_t          occupied_blocks;   // used blocks which are not on the free list
+  size_t          budget_blocks;   // blocks past this number are occupied only after a collection
+  size_t         *free_blocks;   // used blocks left without live data by the last collection
+  size_t          free_blocks_number;
+  size_t          evacuation_reserve;   // blocks evacuation may occupy past the budget
+  size_t         *cursor;   // bump allocation happens in [cursor, limit)
+  size_t         *limit;
+  size_t          next_line;   // search for the next hole continues from this line
+  size_t         *evacuation_cursor;   // evacuated objects are copied to [evacuation_cursor, evacuation_limit)
+  size_t         *evacuation_limit;
+  unsigned char  *live_lines;   // per line: whether it holds (a part of) a live object
+  unsigned short *block_live_lines;   // per block: number of live lines after the last collection
+  unsigned char  *evacuate;   // per block: whether the current collection evacuates its objects
+  size_t         *mark_bits;   // one bit per heap word, set for headers of marked objects
+  size_t          live_words;   // size of objects marked by the last collection
+} region_heap;
+
+static region_heap region;
+static mark_stack  region_mark_stack;
+
+// marks `SWEEP_NO_BLOCK` and `SWEEP_FREE_BLOCK` are never valid block numbers or classes
+#define SWEEP_NO_BLOCK SIZE_MAX
+#define SWEEP_FREE_BLOCK UCHAR_MAX
+
+typedef struct {
+  size_t         used_blocks;   // blocks [0, used_blocks) have been handed out at least once
+  size_t         budget_blocks;   // a collection is needed before size classes get more blocks
+  size_t         class_blocks;   // number of blocks owned by size classes
+  size_t         live_words;   // size of cells marked by the last collection
+  size_t         free_blocks;   // list of blocks without live cells
+  size_t        *free_cells[SWEEP_SIZE_CLASSES];
+  size_t         unswept[SWEEP_SIZE_CLASSES];   // per class: list of blocks to be swept
+  size_t         class_words[SWEEP_SIZE_CLASSES];
+  unsigned char  size_class[SWEEP_MAX_CELL_WORDS + 1];   // per size in words: the smallest class fitting it
+  unsigned char *block_class;   // per block: its size class or SWEEP_FREE_BLOCK
+  unsigned char *block_swept;   // per block: whether it was swept after the last collection
+  size_t        *block_next;   // per block: next block of the list it is in
+} sweep_heap;
+
+static sweep_heap sweep;
+
+typedef struct {
+  size_t  slice_words;   // marking work (in words) done by a single slice, 0 disables incremental marking
+  bool    started;   // snapshot is taken: marking is in progress or completed and waits for compaction
+  size_t *boundary;   // objects at or above it were allocated after the snapshot and are implicitly black
+  size_t *pointer_free_boundary;   // the same for the pointer-free space
+  size_t  credit;   // marking work (in words) earned by allocations and not done yet
+} incremental_state;
+
+static incremental_state incremental;
+static mark_stack        gray_objects;
+bool                     gc_marking_in_progress = false;
+
+static void incremental_step (size_t allocated_words);
+
+// side tables of LISP2 heap, all are indexed by the offset (in words) from the heap begin. New addresses
+// of sliding compaction are computed from `live_bits` and `offset_table` as in the Compressor: the new
+// address of a word is the new address of its block plus the number of live words before it in the block
+#define COMPACT_BLOCK_WORDS 128
+static size_t  *mark_bits;   // one bit per word of the heap reservation, set for headers of marked objects
+static size_t  *live_bits;   // one bit per word of the reservation, set for every word of marked objects
+static size_t **offset_table;   // per block: new address of its first live word
+static size_t **forwarding;   // new header addresses for traversal orders, which don't slide objects
+static size_t   forwarding_words;
+
+// set in `alloc_profile.object_sites` entries of objects which survived a collection
+#define ALLOC_SITE_SURVIVED ALLOC_PROFILE_MAX_SITES
+
+typedef struct {
+  const char     *path;   // NULL if profiling is disabled
+  alloc_site     *sites;
+  size_t          number;
+  size_t          capacity;
+  unsigned short *index;   // open addressing hash table of site numbers plus one, 0 marks empty buckets
+  size_t          index_capacity;
+  unsigned short *object_sites;   // per heap word: site of the object whose header is there
+  void           *last;   // header of the latest allocation, it is attributed on the next one
+  size_t          last_bytes;
+  size_t          last_site;
+} alloc_profile;
+
+size_t               gc_alloc_site = 0;
+static alloc_profile profile;
+
+static void alloc_profile_attribute_last (void);
+static void alloc_profile_move (void *from, void *to);
+
+typedef struct {
+  size_t streak;   // number of the last collections which allow the space to shrink
+  size_t size;   // the largest size needed by them
+} shrink_state;
+
+static shrink_state heap_shrink;
+static shrink_state pointer_free_shrink;
+
+static gc_order compaction_order = GC_ORDER_ADDRESS;
+// new address of the next object placed by a traversal from the roots
+static size_t  *traversal_free;
+// size of survivors laid out by a traversal, 0 if the compaction slides them
+static size_t   scratch_words;
+
+static void         *reserve_memory (size_t bytes);
+static inline bool   bitmap_test (const size_t *bits, size_t i);
+static inline void   bitmap_set (size_t *bits, size_t i);
+static inline size_t heap_word_index (const void *p);
+static inline size_t bitmap_bytes (size_t bits);
+static inline bool   in_pointer_free_space (const void *p);
+static void          visit_root_slots (void (*visit) (void **));
+static void          large_objects_visit_fields (void (*visit) (void **));
+static size_t       *bitmap_next_marked (size_t *from, size_t *end);
+static void         *pointer_free_alloc (size_t size);
+static size_t        compute_pointer_free_locations (void);
+static void          pointer_free_relocate (void);
+
+static void *large_object_alloc (size_t size);
+static bool  large_object_mark (void *obj);
+static void  large_object_shade (void *obj);
+static void  large_objects_drain (void);
+static void  large_objects_sweep (void);
+static void  large_objects_fix_references (void);
+
 void handler (int sig) {
   void *array[10];
   int   size;
@@ -48,7 +211,8 @@ void handler (int sig) {
   exit(1);
 }
 
-void *alloc (size_t size) {
+// `pointer_free` tells that the object has no pointer fields
+static void *alloc_object (size_t size, bool pointer_free) {
 #ifdef DEBUG_VERSION
   ++cur_id;
 #endif
@@ -57,14 +221,159 @@ void *alloc (size_t size) {
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "allocation of size %zu words (%zu bytes): ", size, bytes_sz);
 #endif
-  void *p = gc_alloc_on_existing_heap(size);
-  if (!p) {
-    // not enough place in the heap, need to perform GC cycle
-    p = gc_alloc(size);
+  stats.allocated_bytes += bytes_sz;
+  if (stats_dump_requested) { gc_stats_dump_to_path(); }
+  if (profile.path != NULL) { alloc_profile_attribute_last(); }
+  if (census_dump_requested) { gc_heap_census_dump_to_path(); }
+  if (incremental.slice_words != 0) { incremental_step(size); }
+  void *p;
+  if ((size >= LARGE_OBJECT_WORDS && mode == GC_MODE_LISP2)
+      || (size > SWEEP_MAX_CELL_WORDS && mode == GC_MODE_MARK_SWEEP)) {
+    p = large_object_alloc(size);
+  } else if (pointer_free && mode == GC_MODE_LISP2) {
+    p = pointer_free_alloc(size);
+  } else {
+    p = gc_alloc_on_existing_heap(size);
+    if (!p) {
+      // not enough place in the heap, need to perform GC cycle
+      p = gc_alloc(size);
+    }
+  }
+  if (profile.path != NULL) {
+    profile.last       = p;
+    profile.last_bytes = bytes_sz;
+    profile.last_site  = gc_alloc_site;
   }
   return p;
 }
 
+void *alloc (size_t size) { return alloc_object(size, false); }
+
+static inline unsigned long long now_ns (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// accounts time passed since `start` to `phase`
+static inline void stats_phase_done (gc_phase phase, unsigned long long start) {
+  stats.phase_ns[phase] += now_ns() - start;
+}
+
+static void stats_pause (unsigned long long pause) {
+  stats.total_pause_ns += pause;
+  stats.max_pause_ns = MAX(stats.max_pause_ns, pause);
+  size_t bucket      = 0;
+  for (unsigned long long us = pause / 1000; us != 0 && bucket < GC_PAUSE_HISTOGRAM_BUCKETS - 1;
+       us >>= 1) {
+    ++bucket;
+  }
+  ++stats.pause_histogram[bucket];
+}
+
+static void stats_cycle_done (unsigned long long start, size_t live_words) {
+  unsigned long long pause = now_ns() - start;
+  if (stats.collections == stats.cycles_capacity) {
+    stats.cycles_capacity = MAX(stats.cycles_capacity * 2, 16);
+    stats.cycles          = realloc(stats.cycles, stats.cycles_capacity * sizeof(gc_cycle_stats));
+    if (stats.cycles == NULL) {
+      perror("ERROR: stats_cycle_done: realloc failed\n");
+      exit(1);
+    }
+  }
+  stats.cycles[stats.collections++] =
+      (gc_cycle_stats) {live_words, heap.size + pointer_free.size, pause};
+  stats_pause(pause);
+}
+
+const gc_stats *gc_get_stats (void) { return &stats; }
+
+static const char *mode_name (gc_mode m) {
+  switch (m) {
+    case GC_MODE_LISP2: return "lisp2";
+    case GC_MODE_MARK_REGION: return "mark-region";
+    case GC_MODE_SEMISPACE: return "semispace";
+    case GC_MODE_MARK_SWEEP: return "mark-sweep";
+  }
+  return "unknown";
+}
+
+void gc_stats_dump (FILE *f) {
+  static const char *phase_names[GC_PHASES_NUMBER] = {
+      "mark", "compute_locations", "update_references", "physically_relocate", "copy", "sweep"};
+  fprintf(f, "{\n  \"mode\": \"%s\",\n", mode_name(mode));
+  fprintf(f, "  \"collections\": %zu,\n", stats.collections);
+  fprintf(f, "  \"mark_slices\": %zu,\n", stats.mark_slices);
+  fprintf(f, "  \"allocated_bytes\": %llu,\n", stats.allocated_bytes);
+  fprintf(f, "  \"released_bytes\": %llu,\n", stats.released_bytes);
+  fprintf(f, "  \"heap_words\": %zu,\n", heap.size);
+  if (huge_pages) { fprintf(f, "  \"heap_huge_pages_kb\": %zu,\n", huge_pages_kb(heap.begin)); }
+  fprintf(f, "  \"phase_ns\": {");
+  for (int i = 0; i < GC_PHASES_NUMBER; ++i) {
+    fprintf(f, "%s\"%s\": %llu", i ? ", " : "", phase_names[i], stats.phase_ns[i]);
+  }
+  fprintf(f, "},\n");
+  fprintf(f, "  \"total_pause_ns\": %llu,\n", stats.total_pause_ns);
+  fprintf(f, "  \"max_pause_ns\": %llu,\n", stats.max_pause_ns);
+  fprintf(f, "  \"pause_histogram\": [");
+  bool first = true;
+  for (int i = 0; i < GC_PAUSE_HISTOGRAM_BUCKETS; ++i) {
+    if (stats.pause_histogram[i] == 0) { continue; }
+    fprintf(f,
+            "%s{\"below_us\": %llu, \"count\": %zu}",
+            first ? "" : ", ",
+            1ull << i,
+            stats.pause_histogram[i]);
+    first = false;
+  }
+  fprintf(f, "],\n");
+  fprintf(f, "  \"cycles\": [");
+  for (size_t i = 0; i < stats.collections; ++i) {
+    fprintf(f,
+            "%s\n    {\"live_words\": %zu, \"heap_words\": %zu, \"pause_ns\": %llu}",
+            i ? "," : "",
+            stats.cycles[i].live_words,
+            stats.cycles[i].heap_words,
+            stats.cycles[i].pause_ns);
+  }
+  fprintf(f, "%s]\n}\n", stats.collections ? "\n  " : "");
+}
+
+static void gc_stats_dump_to_path (void) {
+  stats_dump_requested = 0;
+  FILE *f              = fopen(stats_path, "w");
+  if (f == NULL) {
+    perror("ERROR: gc_stats_dump_to_path: fopen failed\n");
+    return;
+  }
+  gc_stats_dump(f);
+  fclose(f);
+}
+
+static void stats_signal_handler (int sig) {
+  (void)sig;
+  stats_dump_requested = 1;
+}
+
+// returns AnonHugePages (in KiB) of the mapping which contains `addr`
+static size_t huge_pages_kb (const void *addr) {
+  FILE *f = fopen("/proc/self/smaps", "r");
+  if (f == NULL) { return 0; }
+  char   line[256];
+  bool   inside = false;
+  size_t kb     = 0;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    size_t begin, end;
+    if (sscanf(line, "%zx-%zx ", &begin, &end) == 2) {
+      inside = begin <= (size_t)addr && (size_t)addr < end;
+    } else if (inside && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+      break;
+    }
+  }
+  fclose(f);
+  return kb;
+}
+
 #ifdef FULL_INVARIANT_CHECKS
 
 // precondition: obj_content is a valid address pointing to the content of an object
@@ -98,13 +407,10 @@ static FILE *print_stack_content (char *filename) {
 }
 
 // precondition: obj_content is a valid address pointing to the content of an object
-static void objects_dfs (FILE *f, void *obj_content) {
+static void objects_dfs (FILE *f, size_t *visited, void *obj_content) {
   void *obj_header = get_obj_header_ptr(obj_content);
-  data *obj_data   = TO_DATA(obj_content);
-  // internal mark-bit for this dfs, should be recovered by the caller
-  if ((obj_data->forward_address & 2) != 0) { return; }
-  // set this bit as 1
-  obj_data->forward_address |= 2;
+  if (bitmap_test(visited, heap_word_index(obj_header))) { return; }
+  bitmap_set(visited, heap_word_index(obj_header));
   fprintf(f, "object at addr %p: ", obj_content);
   print_object_info(f, obj_content);
   /*fprintf(f, "object id: %zu | ", obj_data->id);*/
@@ -125,29 +431,25 @@ static void objects_dfs (FILE *f, void *obj_content) {
        !field_is_done_iterator(&field_it);
        obj_next_field_iterator(&field_it)) {
     size_t field_value = *(size_t *)field_it.cur_field;
-    if (is_valid_heap_pointer((size_t *)field_value)) { objects_dfs(f, (void *)field_value); }
+    if (is_valid_heap_pointer((size_t *)field_value)) {
+      objects_dfs(f, visited, (void *)field_value);
+    }
   }
 }
 
 FILE *print_objects_traversal (char *filename, bool marked) {
   FILE *f = fopen(filename, "w+");
   ftruncate(fileno(f), 0);
+  // internal mark-bits for this dfs
+  size_t *visited =
+      calloc(heap_word_index(MAX(heap.current, pointer_free.current)) / BITS_PER_WORD + 1,
+             sizeof(size_t));
   for (heap_iterator it = heap_begin_iterator(); !heap_is_done_iterator(&it);
        heap_next_obj_iterator(&it)) {
-    void *obj_header = it.current;
-    data *obj_data   = TO_DATA(get_object_content_ptr(obj_header));
-    if ((obj_data->forward_address & 1) == marked) {
-      objects_dfs(f, get_object_content_ptr(obj_header));
-    }
-  }
-
-  // resetting bit that represent mark-bit for this internal dfs-traversal
-  for (heap_iterator it = heap_begin_iterator(); !heap_is_done_iterator(&it);
-       heap_next_obj_iterator(&it)) {
-    void *obj_header = it.current;
-    data *obj_data   = TO_DATA(get_object_content_ptr(obj_header));
-    obj_data->forward_address &= (~2);
+    void *obj_content = get_object_content_ptr(it.current);
+    if (is_marked(obj_content) == marked) { objects_dfs(f, visited, obj_content); }
   }
+  free(visited);
   fflush(f);
 
   // print extra roots
@@ -172,7 +474,16 @@ int files_cmp (FILE *f1, FILE *f2) {
 
 #endif
 
+static void *region_alloc (size_t size);
+static void *sweep_alloc (size_t size);
+static void *sweep_alloc_after_collection (size_t size);
+static void *region_alloc_after_collection (size_t size);
+static void  semispace_collect (size_t additional_size);
+static void  incremental_finish_marking (void);
+
 void *gc_alloc_on_existing_heap (size_t size) {
+  if (mode == GC_MODE_MARK_REGION) { return region_alloc(size); }
+  if (mode == GC_MODE_MARK_SWEEP) { return sweep_alloc(size); }
   if (heap.current + size <= heap.end) {
     void *p = (void *)heap.current;
     heap.current += size;
@@ -186,17 +497,43 @@ void *gc_alloc (size_t size) {
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "===============================GC cycle has started\n");
 #endif
+  // the latest allocation has to get its site before it can be moved
+  alloc_profile_attribute_last();
+  unsigned long long start = now_ns();
+  switch (mode) {
+    case GC_MODE_MARK_REGION:
+      region_collect(size);
+      stats_cycle_done(start, region.live_words);
+      return region_alloc_after_collection(size);
+    case GC_MODE_SEMISPACE:
+      semispace_collect(size);
+      stats_cycle_done(start, heap.current - heap.begin);
+      return gc_alloc_on_existing_heap(size);
+    case GC_MODE_MARK_SWEEP:
+      sweep_collect(size);
+      stats_cycle_done(start, sweep.live_words);
+      return sweep_alloc_after_collection(size);
+    case GC_MODE_LISP2: break;
+  }
 #ifdef FULL_INVARIANT_CHECKS
   FILE *stack_before = print_stack_content("stack-dump-before-compaction");
   FILE *heap_before  = print_objects_traversal("before-mark", 0);
   fclose(heap_before);
 #endif
-  mark_phase();
+  unsigned long long phase_start = now_ns();
+  if (incremental.started) {
+    incremental_finish_marking();
+  } else {
+    mark_phase();
+  }
+  large_objects_sweep();
+  stats_phase_done(GC_PHASE_MARK, phase_start);
 #ifdef FULL_INVARIANT_CHECKS
   FILE *heap_before_compaction = print_objects_traversal("after-mark", 1);
 #endif
 
   compact_phase(size);
+  stats_cycle_done(start, heap.current - heap.begin + pointer_free.current - pointer_free.begin);
 #ifdef FULL_INVARIANT_CHECKS
   FILE *stack_after           = print_stack_content("stack-dump-after-compaction");
   FILE *heap_after_compaction = print_objects_traversal("after-compaction", 0);
@@ -222,9 +559,37 @@ void *gc_alloc (size_t size) {
   return gc_alloc_on_existing_heap(size);
 }
 
+static void        mark_stack_push (mark_stack *s, void *obj);
+static inline bool mark_stack_is_empty (mark_stack *s);
+static inline void *mark_stack_pop (mark_stack *s);
+
+// refreshes `stack_slots`: slots in [__gc_stack_watermark, __gc_stack_bottom) were recorded by the
+// previous scan and haven't changed since then, so only the part of the stack above the watermark is
+// scanned word by word
+static void gc_collect_stack_slots (void) {
+  size_t *top    = (size_t *)(__gc_stack_top + 4);
+  size_t *bottom = (size_t *)__gc_stack_bottom;
+  size_t *clean  = (size_t *)__gc_stack_watermark;
+  if (stack_slots_bottom != bottom || clean < top || clean > bottom) { clean = bottom; }
+
+  size_t reused = 0;
+  while (reused < stack_slots.size && (size_t *)stack_slots.data[reused] >= clean) { ++reused; }
+  stack_slots.size = reused;
+  for (size_t *p = clean; p > top;) {
+    --p;
+    if (is_valid_heap_pointer((size_t *)*p) || is_large_object((void *)*p)) {
+      mark_stack_push(&stack_slots, p);
+    }
+  }
+  stack_slots_bottom = bottom;
+  // frames below the current one can't be modified until it returns
+  __gc_stack_watermark = __gc_stack_frame_limit;
+}
+
 static void gc_root_scan_stack () {
-  for (size_t *p = (size_t *)(__gc_stack_top + 4); p < (size_t *)__gc_stack_bottom; ++p) {
-    gc_test_and_mark_root((size_t **)p);
+  gc_collect_stack_slots();
+  for (size_t i = 0; i < stack_slots.size; ++i) {
+    gc_test_and_mark_root((size_t **)stack_slots.data[i]);
   }
 }
 
@@ -251,83 +616,235 @@ void mark_phase (void) {
 #endif
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "scan_global_area has finished\n");
+#endif
+  large_objects_drain();
+#if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "marking has finished\n");
 #endif
 }
 
+// sets the size of `space` for the next cycle, `needed` is the size (in words) computed from the live
+// size
+static void heap_resize (memory_chunk *space, shrink_state *shrink, size_t needed) {
+  if (needed * HEAP_SHRINK_RATIO > space->size) {
+    shrink->streak = 0;
+    space->size    = MAX(needed, space->size);
+    return;
+  }
+  shrink->size = shrink->streak == 0 ? needed : MAX(shrink->size, needed);
+  if (++shrink->streak < HEAP_SHRINK_CYCLES) { return; }
+  shrink->streak = 0;
+
+  size_t old_size = space->size;
+  space->size     = shrink->size;
+  // pages in the range are committed again on the first touch, zero-filled
+  size_t page  = sysconf(_SC_PAGESIZE);
+  char  *begin = (char *)(((size_t)(space->begin + space->size) + page - 1) & ~(page - 1));
+  char  *end   = (char *)(space->begin + old_size);
+  if (begin < end && madvise(begin, end - begin, MADV_DONTNEED) == 0) {
+    stats.released_bytes += end - begin;
+  }
+}
+
 void compact_phase (size_t additional_size) {
-  size_t live_size = compute_locations();
+  unsigned long long phase_start       = now_ns();
+  size_t             live_size         = compute_locations();
+  size_t             pointer_free_live = compute_pointer_free_locations();
+  stats_phase_done(GC_PHASE_COMPUTE_LOCATIONS, phase_start);
+
+  phase_start = now_ns();
+  update_references();
+  stats_phase_done(GC_PHASE_UPDATE_REFERENCES, phase_start);
+  phase_start = now_ns();
+  physically_relocate();
+  pointer_free_relocate();
+  stats_phase_done(GC_PHASE_PHYSICALLY_RELOCATE, phase_start);
+
+  if (forwarding != NULL) {
+    munmap(forwarding, WORDS_TO_BYTES(forwarding_words));
+    forwarding       = NULL;
+    forwarding_words = 0;
+  }
+  memset(mark_bits, 0, bitmap_bytes(heap.current - heap.begin));
+  memset(live_bits, 0, bitmap_bytes(heap.current - heap.begin));
+  memset(mark_bits + heap_word_index(pointer_free.begin) / BITS_PER_WORD,
+         0,
+         bitmap_bytes(pointer_free.current - pointer_free.begin));
+  memset(live_bits + heap_word_index(pointer_free.begin) / BITS_PER_WORD,
+         0,
+         bitmap_bytes(pointer_free.current - pointer_free.begin));
 
   // all in words
   size_t next_heap_size =
       MAX(live_size * EXTRA_ROOM_HEAP_COEFFICIENT + additional_size, MINIMUM_HEAP_CAPACITY);
-  size_t next_heap_pseudo_size = MAX(next_heap_size, heap.size);
+  heap_resize(&heap, &heap_shrink, next_heap_size);
+  if (heap.size > HEAP_MAX_WORDS) {
+    fprintf(stderr, "ERROR: compact_phase: heap is exhausted\n");
+    exit(1);
+  }
+  heap.end     = heap.begin + heap.size;
+  heap.current = heap.begin + live_size;
 
-  memory_chunk old_heap = heap;
-  heap.begin            = mremap(
-      heap.begin, WORDS_TO_BYTES(heap.size), WORDS_TO_BYTES(next_heap_pseudo_size), MREMAP_MAYMOVE);
-  if (heap.begin == MAP_FAILED) {
-    perror("ERROR: compact_phase: mremap failed\n");
+  size_t next_pointer_free_size = MAX(
+      pointer_free_live * EXTRA_ROOM_HEAP_COEFFICIENT + pointer_free_request, MINIMUM_HEAP_CAPACITY);
+  heap_resize(&pointer_free, &pointer_free_shrink, next_pointer_free_size);
+  if (pointer_free.size > POINTER_FREE_MAX_WORDS) {
+    fprintf(stderr, "ERROR: compact_phase: pointer-free space is exhausted\n");
     exit(1);
   }
-  heap.end     = heap.begin + next_heap_pseudo_size;
-  heap.size    = next_heap_pseudo_size;
-  heap.current = heap.begin + (old_heap.current - old_heap.begin);
+  pointer_free.end     = pointer_free.begin + pointer_free.size;
+  pointer_free.current = pointer_free.begin + pointer_free_live;
+}
+
+static inline bool traversal_is_placed (void *obj) {
+  return forwarding[heap_word_index(TO_DATA(obj))] != NULL;
+}
 
-  update_references(&old_heap);
-  physically_relocate(&old_heap);
+static void traversal_place (void *obj) {
+  size_t *header                      = (size_t *)TO_DATA(obj);
+  forwarding[heap_word_index(header)] = traversal_free;
+  traversal_free += BYTES_TO_WORDS(obj_size_header_ptr(header));
+}
 
-  heap.current = heap.begin + live_size;
+// schedules a heap object which isn't placed yet, the hierarchical order places it right away
+static void traversal_push (void *obj) {
+  if (UNBOXED(obj) || (size_t *)obj < heap.begin || (size_t *)obj > heap.current
+      || traversal_is_placed(obj)) {
+    return;
+  }
+  if (compaction_order == GC_ORDER_HIERARCHICAL) { traversal_place(obj); }
+  mark_stack_push(&gray_objects, obj);
 }
 
+// places everything reachable from the slot which isn't placed yet
+static void traversal_visit_slot (void **slot) {
+  traversal_push(*slot);
+  while (!mark_stack_is_empty(&gray_objects)) {
+    void *obj = mark_stack_pop(&gray_objects);
+    if (compaction_order == GC_ORDER_DEPTH_FIRST) {
+      if (traversal_is_placed(obj)) { continue; }
+      traversal_place(obj);
+    }
+    for (obj_field_iterator field_it = ptr_field_begin_iterator(get_obj_header_ptr(obj));
+         !field_is_done_iterator(&field_it);
+         obj_next_ptr_field_iterator(&field_it)) {
+      traversal_push(*(void **)field_it.cur_field);
+    }
+  }
+}
+
+// the same as `compute_locations`, but survivors are laid out in the order of a traversal from the roots
+static size_t compute_locations_by_traversal (void) {
+  traversal_free = heap.begin;
+  visit_root_slots(traversal_visit_slot);
+  large_objects_visit_fields(traversal_visit_slot);
+  // marked objects which aren't reachable anymore (floating garbage of incremental marking) follow
+  for (heap_iterator it = heap_begin_iterator(); !heap_is_done_iterator(&it);
+       heap_next_obj_iterator(&it)) {
+    void *obj = get_object_content_ptr(it.current);
+    if (is_marked(obj) && !traversal_is_placed(obj)) { traversal_place(obj); }
+  }
+  scratch_words = traversal_free - heap.begin;
+  return scratch_words;
+}
+
+// sets live bits of all words of objects marked in [begin, end) and fills the offset table of the
+// range's blocks, `begin` is block-aligned; only headers of live objects are read. Returns the number
+// of live words, the range slides down to `begin`
+static size_t compute_offsets (size_t *begin, size_t *end) {
+  size_t *header = bitmap_next_marked(begin, end);
+  while (header < end) {
+    size_t words = BYTES_TO_WORDS(obj_size_header_ptr(header));
+    for (size_t i = heap_word_index(header), last = i + words; i < last;) {
+      size_t shift = i % BITS_PER_WORD, n = MIN(BITS_PER_WORD - shift, last - i);
+      size_t mask  = n == BITS_PER_WORD ? ~(size_t)0 : (((size_t)1 << n) - 1) << shift;
+      live_bits[i / BITS_PER_WORD] |= mask;
+      i += n;
+    }
+    header = bitmap_next_marked(header + words, end);
+  }
+  size_t *free_ptr = begin;
+  for (size_t i = heap_word_index(begin); i < heap_word_index(end); i += COMPACT_BLOCK_WORDS) {
+    offset_table[i / COMPACT_BLOCK_WORDS] = free_ptr;
+    for (size_t w = i / BITS_PER_WORD; w < (i + COMPACT_BLOCK_WORDS) / BITS_PER_WORD; ++w) {
+      free_ptr += __builtin_popcountl(live_bits[w]);
+    }
+  }
+  return free_ptr - begin;
+}
+
+// new address of a header: that of its block plus live words preceding it in the block
+static inline size_t *compressed_address (const size_t *header) {
+  size_t  i     = heap_word_index(header);
+  size_t *to    = offset_table[i / COMPACT_BLOCK_WORDS];
+  size_t  first = i / COMPACT_BLOCK_WORDS * COMPACT_BLOCK_WORDS;
+  for (size_t w = first / BITS_PER_WORD; w < i / BITS_PER_WORD; ++w) {
+    to += __builtin_popcountl(live_bits[w]);
+  }
+  if (i % BITS_PER_WORD != 0) {
+    to += __builtin_popcountl(live_bits[i / BITS_PER_WORD]
+                              & (((size_t)1 << (i % BITS_PER_WORD)) - 1));
+  }
+  return to;
+}
+
+// unlike the classic LISP2 nothing is stored per object: survivors slide in address order, so their
+// new addresses are computed from the live bitmap on demand
 size_t compute_locations () {
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "GC compute_locations started\n");
 #endif
-  size_t       *free_ptr  = heap.begin;
-  heap_iterator scan_iter = heap_begin_iterator();
-
-  for (; !heap_is_done_iterator(&scan_iter); heap_next_obj_iterator(&scan_iter)) {
-    void *header_ptr  = scan_iter.current;
-    void *obj_content = get_object_content_ptr(header_ptr);
-    if (is_marked(obj_content)) {
-      size_t sz = BYTES_TO_WORDS(obj_size_header_ptr(header_ptr));
-      // forward address is responsible for object header pointer
-      set_forward_address(obj_content, (size_t)free_ptr);
-      free_ptr += sz;
-    }
+  scratch_words = 0;
+  if (compaction_order != GC_ORDER_ADDRESS && 2 * (heap.current - heap.begin) <= HEAP_MAX_WORDS) {
+    forwarding_words = MAX(heap.current - heap.begin, 1);
+    forwarding       = reserve_memory(WORDS_TO_BYTES(forwarding_words));
+    return compute_locations_by_traversal();
   }
-
+  size_t live_words = compute_offsets(heap.begin, heap.current);
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "GC compute_locations finished\n");
 #endif
   // it will return number of words
-  return free_ptr - heap.begin;
+  return live_words;
 }
 
-void scan_and_fix_region (memory_chunk *old_heap, void *start, void *end) {
+// returns the first header marked in [from, end), or `end` if there is none; the mark bitmap is
+// scanned a word at a time, so dead objects are skipped without being read
+static size_t *bitmap_next_marked (size_t *from, size_t *end) {
+  size_t i = heap_word_index(from), last = heap_word_index(end);
+  while (i < last) {
+    size_t bits = mark_bits[i / BITS_PER_WORD] >> (i % BITS_PER_WORD);
+    if (bits != 0) { return MIN(heap.begin + i + __builtin_ctzl(bits), end); }
+    i = (i / BITS_PER_WORD + 1) * BITS_PER_WORD;
+  }
+  return end;
+}
+
+// the same as `compute_locations` for the pointer-free space, which always slides
+static size_t compute_pointer_free_locations (void) {
+  return compute_offsets(pointer_free.begin, pointer_free.current);
+}
+
+static void fix_slot (size_t *ptr) {
+  size_t ptr_value = *ptr;
+  if (is_valid_heap_pointer((size_t *)ptr_value)) {
+    void *new_addr = (void *)get_forward_address((void *)ptr_value);
+    // all objects have headers of the same size, so the object itself isn't read
+    *(void **)ptr = new_addr + DATA_HEADER_SZ;
+  }
+}
+
+void scan_and_fix_region (void *start, void *end) {
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "GC scan_and_fix_region started\n");
 #endif
-  for (size_t *ptr = (size_t *)start; ptr < (size_t *)end; ++ptr) {
-    size_t ptr_value = *ptr;
-    // this can't be expressed via is_valid_heap_pointer, because this pointer may point area corresponding to the old
-    // heap
-    if (is_valid_pointer((size_t *)ptr_value) && (size_t)old_heap->begin <= ptr_value
-        && ptr_value <= (size_t)old_heap->current) {
-      void *obj_ptr = (void *)heap.begin + ((void *)ptr_value - (void *)old_heap->begin);
-      void *new_addr =
-          (void *)heap.begin + ((void *)get_forward_address(obj_ptr) - (void *)old_heap->begin);
-      size_t content_offset = get_header_size(get_type_row_ptr(obj_ptr));
-      *(void **)ptr         = new_addr + content_offset;
-    }
-  }
+  for (size_t *ptr = (size_t *)start; ptr < (size_t *)end; ++ptr) { fix_slot(ptr); }
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "GC scan_and_fix_region finished\n");
 #endif
 }
 
-void scan_and_fix_region_roots (memory_chunk *old_heap) {
+void scan_and_fix_region_roots (void) {
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "extra roots started: number of extra roots %i\n", extra_roots.current_free);
 #endif
@@ -378,12 +895,8 @@ void scan_and_fix_region_roots (memory_chunk *old_heap) {
 #endif
       continue;
     }
-    if ((size_t)old_heap->begin <= ptr_value && ptr_value <= (size_t)old_heap->current) {
-      void *obj_ptr = (void *)heap.begin + ((void *)ptr_value - (void *)old_heap->begin);
-      void *new_addr =
-          (void *)heap.begin + ((void *)get_forward_address(obj_ptr) - (void *)old_heap->begin);
-      size_t content_offset = get_header_size(get_type_row_ptr(obj_ptr));
-      *(void **)ptr         = new_addr + content_offset;
+    if (is_valid_heap_pointer((size_t *)ptr_value)) {
+      fix_slot(ptr);
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
       fprintf(stderr,
               "|\textra root (%p) %p -> %p\n",
@@ -398,135 +911,174 @@ void scan_and_fix_region_roots (memory_chunk *old_heap) {
 #endif
 }
 
-void update_references (memory_chunk *old_heap) {
-#if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
-  fprintf(stderr, "GC update_references started\n");
-#endif
-  heap_iterator it = heap_begin_iterator();
-  while (!heap_is_done_iterator(&it)) {
-    if (is_marked(get_object_content_ptr(it.current))) {
-      for (obj_field_iterator field_iter = ptr_field_begin_iterator(it.current);
-           !field_is_done_iterator(&field_iter);
-           obj_next_ptr_field_iterator(&field_iter)) {
-
-        size_t *field_value = *(size_t **)field_iter.cur_field;
-        if (field_value < old_heap->begin || field_value > old_heap->current) { continue; }
-        // this pointer should also be modified according to old_heap->begin
-        void *field_obj_content_addr =
-            (void *)heap.begin + (*(void **)field_iter.cur_field - (void *)old_heap->begin);
-        // important, we calculate new_addr very carefully here, because objects may relocate to another memory chunk
-        void *new_addr =
-            heap.begin
-            + ((size_t *)get_forward_address(field_obj_content_addr) - (size_t *)old_heap->begin);
-        // update field reference to point to new_addr
-        // since, we want fields to point to an actual content, we need to add this extra content_offset
-        // because forward_address itself is a pointer to the object's header
-        size_t content_offset = get_header_size(get_type_row_ptr(field_obj_content_addr));
+// fixes pointer fields of a heap object in place
+static void fix_fields (void *header_ptr) {
+  for (obj_field_iterator field_iter = ptr_field_begin_iterator(header_ptr);
+       !field_is_done_iterator(&field_iter);
+       obj_next_ptr_field_iterator(&field_iter)) {
+    void *field_obj_content_addr = *(void **)field_iter.cur_field;
+    if (!is_valid_heap_pointer(field_obj_content_addr)) { continue; }
+    void *new_addr = (void *)get_forward_address(field_obj_content_addr);
+    // update field reference to point to new_addr
+    // since, we want fields to point to an actual content, we need to add this extra content_offset
+    // because the forwarding address itself is a pointer to the object's header; headers of all
+    // objects have the same size, so the referenced object isn't read
+    size_t content_offset = DATA_HEADER_SZ;
 #ifdef DEBUG_VERSION
-        if (!is_valid_heap_pointer((void *)(new_addr + content_offset))) {
+    if (!is_valid_heap_pointer((void *)(new_addr + content_offset))) {
 #  ifdef DEBUG_PRINT
-          fprintf(stderr,
-                  "ur: incorrect pointer assignment: on object with id %d",
-                  TO_DATA(get_object_content_ptr(it.current))->id);
+      fprintf(stderr,
+              "ur: incorrect pointer assignment: on object with id %d",
+              TO_DATA(get_object_content_ptr(header_ptr))->id);
 #  endif
-          exit(1);
-        }
+      exit(1);
+    }
 #endif
-        *(void **)field_iter.cur_field = new_addr + content_offset;
-      }
+    *(void **)field_iter.cur_field = new_addr + content_offset;
+  }
+}
+
+void update_references (void) {
+#if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
+  fprintf(stderr, "GC update_references started\n");
+#endif
+  // sliding compaction fixes fields of heap objects while relocating them
+  if (forwarding != NULL) {
+    for (heap_iterator it = heap_begin_iterator(); !heap_is_done_iterator(&it);
+         heap_next_obj_iterator(&it)) {
+      if (is_marked(get_object_content_ptr(it.current))) { fix_fields(it.current); }
     }
-    heap_next_obj_iterator(&it);
   }
-  // fix pointers from stack
-  scan_and_fix_region(old_heap, (void *)__gc_stack_top + 4, (void *)__gc_stack_bottom + 4);
+  large_objects_fix_references();
+  // fix pointers from stack, all of them were recorded during mark phase
+  for (size_t i = 0; i < stack_slots.size; ++i) { fix_slot(stack_slots.data[i]); }
 
   // fix pointers from extra_roots
-  scan_and_fix_region_roots(old_heap);
+  scan_and_fix_region_roots();
 
 #ifdef LAMA_ENV
   assert((void *)&__stop_custom_data >= (void *)&__start_custom_data);
-  scan_and_fix_region(old_heap, (void *)&__start_custom_data, (void *)&__stop_custom_data);
+  scan_and_fix_region((void *)&__start_custom_data, (void *)&__stop_custom_data);
 #endif
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "GC update_references finished\n");
 #endif
 }
 
-void physically_relocate (memory_chunk *old_heap) {
+// new places of objects laid out by a traversal may overlap old places of others, so survivors are
+// copied to a scratch area past the heap first and then moved back in one block
+static void relocate_through_scratch (void) {
+  size_t *scratch = heap.current;
+  for (heap_iterator it = heap_begin_iterator(); !heap_is_done_iterator(&it);
+       heap_next_obj_iterator(&it)) {
+    void *obj = get_object_content_ptr(it.current);
+    if (!is_marked(obj)) { continue; }
+    size_t *to = scratch + ((size_t *)get_forward_address(obj) - heap.begin);
+    if (profile.path != NULL) { alloc_profile_move(it.current, to); }
+    memcpy(to, it.current, obj_size_header_ptr(it.current));
+  }
+  memcpy(heap.begin, scratch, WORDS_TO_BYTES(scratch_words));
+  if (profile.path != NULL) {
+    memcpy(profile.object_sites,
+           profile.object_sites + heap_word_index(scratch),
+           scratch_words * sizeof(unsigned short));
+  }
+  // pages of the scratch area are committed again on the first touch, zero-filled
+  size_t page  = sysconf(_SC_PAGESIZE);
+  char  *begin = (char *)(((size_t)scratch + page - 1) & ~(page - 1));
+  char  *end   = (char *)((size_t)(scratch + scratch_words) & ~(page - 1));
+  if (begin < end) { madvise(begin, end - begin, MADV_DONTNEED); }
+}
+
+void physically_relocate (void) {
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "GC physically_relocate started\n");
 #endif
-  heap_iterator from_iter = heap_begin_iterator();
-
-  while (!heap_is_done_iterator(&from_iter)) {
-    void         *obj       = get_object_content_ptr(from_iter.current);
-    heap_iterator next_iter = from_iter;
-    heap_next_obj_iterator(&next_iter);
-    if (is_marked(obj)) {
-      // Move the object from its old location to its new location relative to
-      // the heap's (possibly new) location, 'to' points to future object header
-      size_t *to = heap.begin + ((size_t *)get_forward_address(obj) - (size_t *)old_heap->begin);
-      memmove(to, from_iter.current, obj_size_header_ptr(from_iter.current));
-      unmark_object(get_object_content_ptr(to));
-    }
-    from_iter = next_iter;
+  if (scratch_words != 0) {
+    relocate_through_scratch();
+    return;
+  }
+  // a single pass in address order: fields of each survivor are fixed in place and then it slides
+  // down; new addresses come from the side tables only, so neither already moved objects nor not
+  // yet fixed ones are read, and a move overwrites only objects which are done or dead
+  size_t *to     = heap.begin;
+  size_t *header = bitmap_next_marked(heap.begin, heap.current);
+  while (header < heap.current) {
+    size_t bytes = obj_size_header_ptr(header);
+    size_t *next = bitmap_next_marked(header + BYTES_TO_WORDS(bytes), heap.current);
+    fix_fields(header);
+    if (profile.path != NULL) { alloc_profile_move(header, to); }
+    memmove(to, header, bytes);
+    to += BYTES_TO_WORDS(bytes);
+    header = next;
   }
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "GC physically_relocate finished\n");
 #endif
 }
 
-inline bool is_valid_heap_pointer (const size_t *p) {
-  return !UNBOXED(p) && (size_t)heap.begin <= (size_t)p && (size_t)p <= (size_t)heap.current;
+// the same as `physically_relocate` for the pointer-free space
+static void pointer_free_relocate (void) {
+  size_t *to     = pointer_free.begin;
+  size_t *header = bitmap_next_marked(pointer_free.begin, pointer_free.current);
+  while (header < pointer_free.current) {
+    size_t bytes = obj_size_header_ptr(header);
+    if (profile.path != NULL) { alloc_profile_move(header, to); }
+    memmove(to, header, bytes);
+    to += BYTES_TO_WORDS(bytes);
+    header = bitmap_next_marked(header + BYTES_TO_WORDS(bytes), pointer_free.current);
+  }
 }
 
-static inline bool is_valid_pointer (const size_t *p) { return !UNBOXED(p); }
-
-static inline void queue_enqueue (heap_iterator *tail_iter, void *obj) {
-  void *tail         = tail_iter->current;
-  void *tail_content = get_object_content_ptr(tail);
-  set_forward_address(tail_content, (size_t)obj);
-  make_enqueued(obj);
-  heap_next_obj_iterator(tail_iter);
+static inline bool in_pointer_free_space (const void *p) {
+  return (const size_t *)p >= pointer_free.begin && (const size_t *)p < pointer_free.current;
 }
 
-static inline void *queue_dequeue (heap_iterator *head_iter) {
-  void *head         = head_iter->current;
-  void *head_content = get_object_content_ptr(head);
-  void *value        = (void *)get_forward_address(head_content);
-  make_dequeued(value);
-  heap_next_obj_iterator(head_iter);
-  return value;
+inline bool is_valid_heap_pointer (const size_t *p) {
+  return !UNBOXED(p)
+         && (((size_t)heap.begin <= (size_t)p && (size_t)p <= (size_t)heap.current)
+             || in_pointer_free_space(p));
 }
 
+static inline bool is_valid_pointer (const size_t *p) { return !UNBOXED(p); }
+
 void mark (void *obj) {
-  if (!is_valid_heap_pointer(obj) || is_marked(obj)) { return; }
-
-  // TL;DR: [q_head_iter, q_tail_iter) q_head_iter -- current dequeue's victim, q_tail_iter -- place for next enqueue
-  // in forward_address of corresponding element we store address of element to be removed after dequeue operation
-  heap_iterator q_head_iter = heap_begin_iterator();
-  // iterator where we will write address of the element that is going to be enqueued
-  heap_iterator q_tail_iter = q_head_iter;
-  queue_enqueue(&q_tail_iter, obj);
-
-  // invariant: queue contains only objects that are valid heap pointers (each corresponding to content of unmarked
-  // object) also each object is in queue only once
-  while (q_head_iter.current != q_tail_iter.current) {
-    // while the queue is non-empty
-    void *cur_obj = queue_dequeue(&q_head_iter);
-    mark_object(cur_obj);
-    void *header_ptr = get_obj_header_ptr(cur_obj);
+  if (!is_valid_heap_pointer(obj)) {
+    large_object_shade(obj);
+    return;
+  }
+  if (is_marked(obj)) { return; }
+  mark_object(obj);
+  // objects of the pointer-free space have no fields to scan
+  if (in_pointer_free_space(obj)) { return; }
+  mark_stack_push(&gray_objects, obj);
+
+  // objects popped from the stack wait in a FIFO window for MARK_PREFETCH_WINDOW scans, so their
+  // headers are likely to be in cache by the time they are scanned
+  void  *window[MARK_PREFETCH_WINDOW];
+  size_t window_head = 0, window_size = 0;
+  // invariant: the stack and the window contain only marked heap objects whose fields are not scanned yet
+  while (true) {
+    while (window_size < MARK_PREFETCH_WINDOW && !mark_stack_is_empty(&gray_objects)) {
+      void *gray = mark_stack_pop(&gray_objects);
+      __builtin_prefetch(TO_DATA(gray));
+      window[(window_head + window_size++) % MARK_PREFETCH_WINDOW] = gray;
+    }
+    if (window_size == 0) { break; }
+    void *header_ptr = get_obj_header_ptr(window[window_head]);
+    window_head      = (window_head + 1) % MARK_PREFETCH_WINDOW;
+    --window_size;
     for (obj_field_iterator ptr_field_it = ptr_field_begin_iterator(header_ptr);
          !field_is_done_iterator(&ptr_field_it);
          obj_next_ptr_field_iterator(&ptr_field_it)) {
       void *field_value = *(void **)ptr_field_it.cur_field;
-      if (!is_valid_heap_pointer(field_value) || is_marked(field_value)
-          || is_enqueued(field_value)) {
+      if (!is_valid_heap_pointer(field_value)) {
+        large_object_shade(field_value);
         continue;
       }
-      // if we came to this point it must be true that field_value is unmarked and not currently in queue
-      // thus, we maintain the invariant
-      queue_enqueue(&q_tail_iter, field_value);
+      if (is_marked(field_value)) { continue; }
+      mark_object(field_value);
+      if (!in_pointer_free_space(field_value)) { mark_stack_push(&gray_objects, field_value); }
     }
   }
 }
@@ -559,8 +1111,1245 @@ extern void gc_test_and_mark_root (size_t **root) {
   mark((void *)*root);
 }
 
+static void mark_stack_push (mark_stack *s, void *obj) {
+  if (s->size == s->capacity) {
+    s->capacity = MAX(s->capacity * 2, MARK_STACK_INITIAL_CAPACITY);
+    s->data     = realloc(s->data, s->capacity * sizeof(void *));
+    if (s->data == NULL) {
+      perror("ERROR: mark_stack_push: realloc failed\n");
+      exit(1);
+    }
+  }
+  s->data[s->size++] = obj;
+}
+
+static inline bool mark_stack_is_empty (mark_stack *s) { return s->size == 0; }
+
+static inline void *mark_stack_pop (mark_stack *s) { return s->data[--s->size]; }
+
+static void mark_stack_free (mark_stack *s) {
+  free(s->data);
+  s->data     = NULL;
+  s->size     = 0;
+  s->capacity = 0;
+}
+
+// reserves address space which is committed lazily, on the first touch of each page
+static void *reserve_memory (size_t bytes) {
+  void *p = mmap(NULL,
+                 bytes,
+                 PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_32BIT,
+                 -1,
+                 0);
+  if (p == MAP_FAILED) {
+    perror("ERROR: reserve_memory: mmap failed\n");
+    exit(1);
+  }
+  return p;
+}
+
+void gc_set_huge_pages (bool enabled) { huge_pages = enabled; }
+
+void gc_advise_huge_pages (void *begin, size_t bytes) {
+  if (huge_pages && madvise(begin, bytes, MADV_HUGEPAGE) != 0) {
+    perror("WARNING: gc_advise_huge_pages: madvise failed");
+  }
+}
+
+// reserves address space for a heap, aligned to HUGE_PAGE_SIZE if huge pages are enabled
+static void *reserve_heap_memory (size_t bytes) {
+  if (!huge_pages) { return reserve_memory(bytes); }
+  char *p       = reserve_memory(bytes + HUGE_PAGE_SIZE);
+  char *aligned = (char *)(((size_t)p + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1));
+  if (aligned != p) { munmap(p, aligned - p); }
+  if (aligned != p + HUGE_PAGE_SIZE) { munmap(aligned + bytes, p + HUGE_PAGE_SIZE - aligned); }
+  gc_advise_huge_pages(aligned, bytes);
+  return aligned;
+}
+
+/* Side tables of LISP2 heap */
+
+static inline size_t heap_word_index (const void *p) { return (const size_t *)p - heap.begin; }
+
+static inline bool bitmap_test (const size_t *bits, size_t i) {
+  return (bits[i / BITS_PER_WORD] >> (i % BITS_PER_WORD)) & 1;
+}
+
+static inline void bitmap_set (size_t *bits, size_t i) {
+  bits[i / BITS_PER_WORD] |= (size_t)1 << (i % BITS_PER_WORD);
+}
+
+static inline size_t bitmap_bytes (size_t bits) {
+  return WORDS_TO_BYTES((bits + BITS_PER_WORD - 1) / BITS_PER_WORD);
+}
+
+
+/* Large-object space */
+
+typedef struct {
+  size_t        *header;
+  bool           marked;
+  unsigned short site;   // allocation site, if allocations are profiled
+} large_object;
+
+typedef struct {
+  large_object *objects;   // sorted by address
+  size_t        number;
+  size_t        capacity;
+  size_t        words;   // total size of large objects
+  size_t        budget;   // allocation which makes `words` exceed it triggers a collection
+} large_object_space;
+
+static large_object_space large = {NULL, 0, 0, 0, LARGE_OBJECT_MINIMUM_BUDGET};
+// marked large objects whose fields are not scanned yet
+static mark_stack         large_gray;
+
+// returns index of the first large object with header at or above `header`
+static size_t large_object_lower_bound (const size_t *header) {
+  size_t l = 0, r = large.number;
+  while (l < r) {
+    size_t m = l + (r - l) / 2;
+    if (large.objects[m].header < header) {
+      l = m + 1;
+    } else {
+      r = m;
+    }
+  }
+  return l;
+}
+
+// returns index of the large object with content `obj`, or `large.number` if there is none
+static size_t large_object_find (const void *obj) {
+  if (large.number == 0 || UNBOXED(obj)) { return large.number; }
+  const size_t *header = get_obj_header_ptr((void *)obj);
+  size_t        i      = large_object_lower_bound(header);
+  return i < large.number && large.objects[i].header == header ? i : large.number;
+}
+
+bool is_large_object (const void *obj) { return large_object_find(obj) != large.number; }
+
+bool is_runtime_object (const void *obj) {
+  return is_valid_heap_pointer(obj) || is_large_object(obj);
+}
+
+// marks the large object, returns false if it was already marked
+static bool large_object_mark (void *obj) {
+  large_object *o = &large.objects[large_object_find(obj)];
+  if (o->marked) { return false; }
+  o->marked = true;
+  return true;
+}
+
+static void large_object_shade (void *obj) {
+  if (is_large_object(obj) && large_object_mark(obj)) { mark_stack_push(&large_gray, obj); }
+}
+
+// scans fields of large objects marked by `mark`, which may mark some more of them
+static void large_objects_drain (void) {
+  while (!mark_stack_is_empty(&large_gray)) {
+    void *obj = mark_stack_pop(&large_gray);
+    for (obj_field_iterator field_it = ptr_field_begin_iterator(get_obj_header_ptr(obj));
+         !field_is_done_iterator(&field_it);
+         obj_next_ptr_field_iterator(&field_it)) {
+      mark(*(void **)field_it.cur_field);
+    }
+  }
+}
+
+// unmaps unmarked large objects and clears marks of the others
+static void large_objects_sweep (void) {
+  size_t kept = 0;
+  large.words = 0;
+  for (size_t i = 0; i < large.number; ++i) {
+    large_object o = large.objects[i];
+    size_t       bytes = obj_size_header_ptr(o.header);
+    if (!o.marked) {
+      munmap(o.header, bytes);
+      continue;
+    }
+    large.words += BYTES_TO_WORDS(bytes);
+    if (profile.path != NULL && !(o.site & ALLOC_SITE_SURVIVED)) {
+      ++profile.sites[o.site].survived;
+      o.site |= ALLOC_SITE_SURVIVED;
+    }
+    large.objects[kept++] = (large_object) {o.header, false, o.site};
+  }
+  large.number = kept;
+  large.budget = MAX(large.words * EXTRA_ROOM_HEAP_COEFFICIENT, LARGE_OBJECT_MINIMUM_BUDGET);
+}
+
+// large objects aren't moved, but their fields may point to objects which are
+static void large_objects_fix_references (void) {
+  for (size_t i = 0; i < large.number; ++i) {
+    for (obj_field_iterator field_it = ptr_field_begin_iterator(large.objects[i].header);
+         !field_is_done_iterator(&field_it);
+         obj_next_ptr_field_iterator(&field_it)) {
+      fix_slot(field_it.cur_field);
+    }
+  }
+}
+
+// large objects are roots of a traversal which lays out the heap
+static void large_objects_visit_fields (void (*visit) (void **)) {
+  for (size_t i = 0; i < large.number; ++i) {
+    for (obj_field_iterator field_it = ptr_field_begin_iterator(large.objects[i].header);
+         !field_is_done_iterator(&field_it);
+         obj_next_ptr_field_iterator(&field_it)) {
+      visit(field_it.cur_field);
+    }
+  }
+}
+
+static void *large_object_alloc (size_t size) {
+  if (large.words + size > large.budget) {
+    // the result is an empty allocation, only the collection is needed
+    gc_alloc(0);
+  }
+  size_t *header = mmap(NULL,
+                        WORDS_TO_BYTES(size),
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT,
+                        -1,
+                        0);
+  if (header == MAP_FAILED) {
+    perror("ERROR: large_object_alloc: mmap failed\n");
+    exit(1);
+  }
+  if (large.number == large.capacity) {
+    large.capacity = MAX(large.capacity * 2, 16);
+    large.objects  = realloc(large.objects, large.capacity * sizeof(large_object));
+    if (large.objects == NULL) {
+      perror("ERROR: large_object_alloc: realloc failed\n");
+      exit(1);
+    }
+  }
+  size_t i = large_object_lower_bound(header);
+  memmove(&large.objects[i + 1], &large.objects[i], (large.number - i) * sizeof(large_object));
+  // allocated during incremental marking means allocated after the snapshot, i.e. black
+  large.objects[i] = (large_object) {header, incremental.started, 0};
+  ++large.number;
+  large.words += size;
+  return header;
+}
+
+static void large_objects_free (void) {
+  for (size_t i = 0; i < large.number; ++i) {
+    munmap(large.objects[i].header, obj_size_header_ptr(large.objects[i].header));
+  }
+  free(large.objects);
+  mark_stack_free(&large_gray);
+  large = (large_object_space) {NULL, 0, 0, 0, LARGE_OBJECT_MINIMUM_BUDGET};
+}
+
+/* Pointer-free space */
+
+static void *pointer_free_alloc (size_t size) {
+  if (pointer_free.current + size > pointer_free.end) {
+    pointer_free_request = size;
+    // the result is an empty allocation, only the collection is needed
+    gc_alloc(0);
+    pointer_free_request = 0;
+  }
+  void *p = pointer_free.current;
+  pointer_free.current += size;
+  memset(p, 0, WORDS_TO_BYTES(size));
+  return p;
+}
+
+/* Mark-region heap */
+
+static inline bool region_is_marked (void *header_ptr) {
+  return bitmap_test(region.mark_bits, heap_word_index(header_ptr));
+}
+
+static inline void region_mark_object (void *header_ptr) {
+  bitmap_set(region.mark_bits, heap_word_index(header_ptr));
+}
+
+static void region_mark_lines (void *header_ptr, size_t words) {
+  size_t first = heap_word_index(header_ptr) / REGION_LINE_WORDS;
+  size_t last  = (heap_word_index(header_ptr) + words - 1) / REGION_LINE_WORDS;
+  for (size_t line = first; line <= last; ++line) {
+    if (region.live_lines[line]) { continue; }
+    region.live_lines[line] = 1;
+    ++region.block_live_lines[line / REGION_LINES_PER_BLOCK];
+  }
+}
+
+// hands out `n` blocks, a free one if a single block is asked for and there is one, never used ones
+// otherwise; returns NULL if the reserved range is exhausted
+static size_t *region_take_blocks (size_t n) {
+  if (n == 1 && region.free_blocks_number > 0) {
+    ++region.occupied_blocks;
+    return heap.begin + region.free_blocks[--region.free_blocks_number] * REGION_BLOCK_WORDS;
+  }
+  if (region.used_blocks + n > REGION_MAX_BLOCKS) { return NULL; }
+  size_t *block = heap.begin + region.used_blocks * REGION_BLOCK_WORDS;
+  region.used_blocks += n;
+  region.occupied_blocks += n;
+  heap.current = heap.begin + region.used_blocks * REGION_BLOCK_WORDS;
+  return block;
+}
+
+// holes are looked for only in blocks which were partially occupied after the last collection,
+// free blocks are handed out whole and the ones taken since hold no holes yet
+static inline bool region_line_is_free (size_t line) {
+  return !region.live_lines[line] && region.block_live_lines[line / REGION_LINES_PER_BLOCK] != 0;
+}
+
+// moves the allocation cursor to the next hole of at least `size` words, returns false if there is none
+static bool region_next_hole (size_t size) {
+  size_t used_lines = region.used_blocks * REGION_LINES_PER_BLOCK;
+  size_t line       = region.next_line;
+  while (line < used_lines) {
+    while (line < used_lines && !region_line_is_free(line)) { ++line; }
+    size_t hole_begin = line;
+    while (line < used_lines && region_line_is_free(line)) { ++line; }
+    if (line > hole_begin && (line - hole_begin) * REGION_LINE_WORDS >= size) {
+      region.cursor    = heap.begin + hole_begin * REGION_LINE_WORDS;
+      region.limit     = heap.begin + line * REGION_LINE_WORDS;
+      region.next_line = line;
+      return true;
+    }
+  }
+  region.next_line = used_lines;
+  return false;
+}
+
+static inline void *region_bump (size_t size) {
+  void *p = region.cursor;
+  region.cursor += size;
+  memset(p, 0, WORDS_TO_BYTES(size));
+  return p;
+}
+
+static void *region_alloc (size_t size) {
+  while (region.cursor == NULL || region.cursor + size > region.limit) {
+    if (region_next_hole(size)) { continue; }
+    // no hole fits, the object goes to a free block or to fresh ones (several if it is large)
+    size_t n = MAX((size + REGION_BLOCK_WORDS - 1) / REGION_BLOCK_WORDS, 1);
+    if (region.occupied_blocks + n > region.budget_blocks) { return NULL; }
+    size_t *block = region_take_blocks(n);
+    if (block == NULL) { return NULL; }
+    region.cursor = block;
+    region.limit  = block + n * REGION_BLOCK_WORDS;
+  }
+  return region_bump(size);
+}
+
+static void *region_alloc_after_collection (size_t size) {
+  void *p = region_alloc(size);
+  if (p == NULL) {
+    // the budget computed from the live size is too small for this particular request
+    region.budget_blocks =
+        region.occupied_blocks + MAX((size + REGION_BLOCK_WORDS - 1) / REGION_BLOCK_WORDS, 1);
+    heap.size = region.budget_blocks * REGION_BLOCK_WORDS;
+    p         = region_alloc(size);
+  }
+  if (p == NULL) {
+    fprintf(stderr, "ERROR: gc_alloc: mark-region heap is exhausted\n");
+    exit(1);
+  }
+  return p;
+}
+
+// copies an object of `words` words out of a block chosen for evacuation, returns NULL if there is no room
+static size_t *region_evacuation_alloc (size_t words) {
+  if (region.evacuation_cursor == NULL || region.evacuation_cursor + words > region.evacuation_limit) {
+    if (region.occupied_blocks >= region.budget_blocks + region.evacuation_reserve) { return NULL; }
+    size_t *block = region_take_blocks(1);
+    if (block == NULL) { return NULL; }
+    region.evacuation_cursor = block;
+    region.evacuation_limit  = block + REGION_BLOCK_WORDS;
+  }
+  size_t *p = region.evacuation_cursor;
+  region.evacuation_cursor += words;
+  return p;
+}
+
+// marks the object referenced from `slot` (evacuating it if needed) and schedules it for scanning
+static void region_trace_slot (void **slot) {
+  void *obj = *slot;
+  if (!is_valid_heap_pointer(obj)) { return; }
+  data *d = TO_DATA(obj);
+  // only headers of objects which were already evacuated by this collection are forwarded
+  if (IS_FORWARDED(d->data_header)) {
+    *slot = (void *)(size_t)d->data_header;
+    return;
+  }
+  void *header_ptr = get_obj_header_ptr(obj);
+  if (region_is_marked(header_ptr)) { return; }
+  size_t words = BYTES_TO_WORDS(obj_size_header_ptr(header_ptr));
+  if (region.evacuate[heap_word_index(header_ptr) / REGION_BLOCK_WORDS]
+      && words <= REGION_BLOCK_WORDS) {
+    size_t *copy = region_evacuation_alloc(words);
+    if (copy != NULL) {
+      memcpy(copy, header_ptr, WORDS_TO_BYTES(words));
+      header_ptr     = copy;
+      obj            = get_object_content_ptr(copy);
+      d->data_header = (int)(size_t)obj;
+      *slot          = obj;
+    }
+  }
+  region_mark_object(header_ptr);
+  region_mark_lines(header_ptr, words);
+  region.live_words += words;
+  mark_stack_push(&region_mark_stack, obj);
+}
+
+// calls `visit` for every root slot: Lama stack, extra roots and global area
+// (a slot may be visited twice if an extra root points to the stack)
+static void visit_root_slots (void (*visit) (void **)) {
+  gc_collect_stack_slots();
+  for (size_t i = 0; i < stack_slots.size; ++i) { visit(stack_slots.data[i]); }
+  for (int i = 0; i < extra_roots.current_free; ++i) { visit(extra_roots.roots[i]); }
+#ifdef LAMA_ENV
+  for (size_t *p = (size_t *)&__start_custom_data; p < (size_t *)&__stop_custom_data; ++p) {
+    visit((void **)p);
+  }
+#endif
+}
+
+void region_collect (size_t additional_size) {
+  size_t used_blocks = region.used_blocks;
+  // evacuation candidates are chosen by occupancy observed by the previous collection; they are
+  // freed by the collection, so evacuation may occupy as many blocks past the budget
+  region.evacuation_reserve = 0;
+  for (size_t b = 0; b < used_blocks; ++b) {
+    region.evacuate[b] = region.block_live_lines[b] != 0
+                         && region.block_live_lines[b] <= REGION_EVACUATION_THRESHOLD;
+    region.evacuation_reserve += region.evacuate[b];
+  }
+  memset(region.mark_bits, 0, used_blocks * REGION_BLOCK_WORDS / 8);
+  memset(region.live_lines, 0, used_blocks * REGION_LINES_PER_BLOCK);
+  memset(region.block_live_lines, 0, used_blocks * sizeof(unsigned short));
+  region.evacuation_cursor = NULL;
+  region.evacuation_limit  = NULL;
+  region.live_words        = 0;
+
+  unsigned long long phase_start = now_ns();
+  visit_root_slots(region_trace_slot);
+  while (!mark_stack_is_empty(&region_mark_stack)) {
+    void *obj = mark_stack_pop(&region_mark_stack);
+    for (obj_field_iterator field_it = ptr_field_begin_iterator(get_obj_header_ptr(obj));
+         !field_is_done_iterator(&field_it);
+         obj_next_ptr_field_iterator(&field_it)) {
+      region_trace_slot((void **)field_it.cur_field);
+    }
+  }
+  stats_phase_done(GC_PHASE_MARK, phase_start);
+  memset(region.evacuate, 0, used_blocks);
+
+  // blocks left without live data, emptied evacuation sources among them, are reused first
+  size_t live_lines         = 0;
+  region.free_blocks_number = 0;
+  for (size_t b = 0; b < region.used_blocks; ++b) {
+    live_lines += region.block_live_lines[b];
+    if (region.block_live_lines[b] == 0) { region.free_blocks[region.free_blocks_number++] = b; }
+  }
+  region.occupied_blocks    = region.used_blocks - region.free_blocks_number;
+  region.evacuation_reserve = 0;
+  size_t live_blocks = (live_lines + REGION_LINES_PER_BLOCK - 1) / REGION_LINES_PER_BLOCK;
+  region.budget_blocks =
+      MAX(live_blocks * EXTRA_ROOM_HEAP_COEFFICIENT
+              + (additional_size + REGION_BLOCK_WORDS - 1) / REGION_BLOCK_WORDS,
+          REGION_MINIMUM_BLOCKS);
+  heap.size = region.budget_blocks * REGION_BLOCK_WORDS;
+
+  // allocation starts over from the first hole
+  region.cursor    = NULL;
+  region.limit     = NULL;
+  region.next_line = 0;
+}
+
+/* Semispace heap */
+
+static size_t  semispace_reserved;   // size (in words) of the mapping that holds the current space
+static size_t *semispace_free;   // Cheney's free pointer into to-space
+
+// copies the object referenced from `slot` to to-space (once) and updates the slot
+static void semispace_forward_slot (void **slot) {
+  void *obj = *slot;
+  // to-space is a separate mapping, so slots which were already updated are skipped here
+  if (!is_valid_heap_pointer(obj)) { return; }
+  data *d = TO_DATA(obj);
+  if (!IS_FORWARDED(d->data_header)) {
+    void  *header_ptr = get_obj_header_ptr(obj);
+    size_t words      = BYTES_TO_WORDS(obj_size_header_ptr(header_ptr));
+    memcpy(semispace_free, header_ptr, WORDS_TO_BYTES(words));
+    d->data_header = (int)(size_t)get_object_content_ptr(semispace_free);
+    semispace_free += words;
+  }
+  *slot = (void *)(size_t)d->data_header;
+}
+
+static void semispace_collect (size_t additional_size) {
+  // everything allocated so far fits into the space of the same size, the rest is room for growth
+  size_t  used     = heap.current - heap.begin;
+  size_t  reserved = MAX(used * EXTRA_ROOM_HEAP_COEFFICIENT + additional_size, MINIMUM_HEAP_CAPACITY);
+  size_t *to_space = reserve_memory(WORDS_TO_BYTES(reserved));
+
+  unsigned long long phase_start = now_ns();
+  semispace_free                 = to_space;
+  visit_root_slots(semispace_forward_slot);
+  // breadth-first: objects between `scan` and `semispace_free` are copied but not scanned yet
+  for (size_t *scan = to_space; scan < semispace_free;
+       scan += BYTES_TO_WORDS(obj_size_header_ptr(scan))) {
+    for (obj_field_iterator field_it = ptr_field_begin_iterator(scan);
+         !field_is_done_iterator(&field_it);
+         obj_next_ptr_field_iterator(&field_it)) {
+      semispace_forward_slot((void **)field_it.cur_field);
+    }
+  }
+  stats_phase_done(GC_PHASE_COPY, phase_start);
+
+  munmap(heap.begin, WORDS_TO_BYTES(semispace_reserved));
+  size_t live_size   = semispace_free - to_space;
+  semispace_reserved = reserved;
+  heap.begin         = to_space;
+  heap.current       = semispace_free;
+  heap.size =
+      MAX(live_size * EXTRA_ROOM_HEAP_COEFFICIENT + additional_size, MINIMUM_HEAP_CAPACITY);
+  heap.end = heap.begin + heap.size;
+}
+
+/* Mark-sweep heap */
+
+static void sweep_init_classes (void) {
+  // four classes per power of two above 8 words, one per size below
+  size_t n = 0;
+  for (size_t words = 1; words <= SWEEP_MAX_CELL_WORDS;) {
+    sweep.class_words[n++] = words;
+    words += words < 8 ? 1 : (size_t)1 << (BITS_PER_WORD - 3 - __builtin_clzl(words));
+  }
+  for (size_t words = 0, c = 0; words <= SWEEP_MAX_CELL_WORDS; ++words) {
+    while (sweep.class_words[c] < words) { ++c; }
+    sweep.size_class[words] = c;
+  }
+}
+
+static inline size_t *sweep_block_begin (size_t block) {
+  return heap.begin + block * SWEEP_BLOCK_WORDS;
+}
+
+// links all cells of the block which are not marked into the free list of its class
+static void sweep_block (size_t block) {
+  size_t  c     = sweep.block_class[block];
+  size_t  words = sweep.class_words[c];
+  size_t *begin = sweep_block_begin(block);
+  // cells are linked from the end, so that they are handed out in address order
+  for (size_t i = SWEEP_BLOCK_WORDS / words; i-- > 0;) {
+    size_t *cell = begin + i * words;
+    if (bitmap_test(mark_bits, heap_word_index(cell))) { continue; }
+    *cell               = (size_t)sweep.free_cells[c];
+    sweep.free_cells[c] = cell;
+  }
+  sweep.block_swept[block] = 1;
+}
+
+// hands an empty block over to size class `c`, returns false if the budget doesn't allow it
+static bool sweep_take_block (size_t c) {
+  if (sweep.class_blocks >= sweep.budget_blocks) { return false; }
+  size_t block = sweep.free_blocks;
+  if (block != SWEEP_NO_BLOCK) {
+    sweep.free_blocks = sweep.block_next[block];
+  } else {
+    if (sweep.used_blocks == SWEEP_MAX_BLOCKS) { return false; }
+    block        = sweep.used_blocks++;
+    heap.current = sweep_block_begin(sweep.used_blocks);
+  }
+  ++sweep.class_blocks;
+  // the block has no marked cells, so all of them become free
+  sweep.block_class[block] = c;
+  sweep_block(block);
+  return true;
+}
+
+static void *sweep_alloc (size_t size) {
+  size_t c = sweep.size_class[size];
+  // blocks which survived the last collection are swept lazily, only when the class runs out of cells
+  while (sweep.free_cells[c] == NULL) {
+    size_t block = sweep.unswept[c];
+    if (block != SWEEP_NO_BLOCK) {
+      sweep.unswept[c] = sweep.block_next[block];
+      sweep_block(block);
+    } else if (!sweep_take_block(c)) {
+      return NULL;
+    }
+  }
+  size_t *cell        = sweep.free_cells[c];
+  sweep.free_cells[c] = (size_t *)*cell;
+  memset(cell, 0, WORDS_TO_BYTES(size));
+  return cell;
+}
+
+static void *sweep_alloc_after_collection (size_t size) {
+  // the result is an empty allocation, only the collection was needed
+  if (size == 0) { return NULL; }
+  void *p = sweep_alloc(size);
+  if (p == NULL) {
+    // the budget computed from the live size is too small for this particular request
+    sweep.budget_blocks = sweep.class_blocks + 1;
+    heap.size           = sweep.budget_blocks * SWEEP_BLOCK_WORDS;
+    p                   = sweep_alloc(size);
+  }
+  if (p == NULL) {
+    fprintf(stderr, "ERROR: gc_alloc: mark-sweep heap is exhausted\n");
+    exit(1);
+  }
+  return p;
+}
+
+// returns the number of cells of the block marked by the last collection
+static size_t sweep_block_live_cells (size_t block) {
+  size_t *bits  = mark_bits + heap_word_index(sweep_block_begin(block)) / BITS_PER_WORD;
+  size_t  cells = 0;
+  for (size_t i = 0; i < SWEEP_BLOCK_WORDS / BITS_PER_WORD; ++i) {
+    cells += __builtin_popcountl(bits[i]);
+  }
+  return cells;
+}
+
+// returns the first header at or after `from` of an object which hasn't been found dead, or heap.current
+static size_t *sweep_next_object (size_t *from) {
+  for (size_t block = heap_word_index(from) / SWEEP_BLOCK_WORDS; block < sweep.used_blocks; ++block) {
+    if (sweep.block_class[block] == SWEEP_FREE_BLOCK) { continue; }
+    size_t  words = sweep.class_words[sweep.block_class[block]];
+    size_t *begin = sweep_block_begin(block);
+    for (size_t i = from > begin ? (from - begin + words - 1) / words : 0;
+         (i + 1) * words <= SWEEP_BLOCK_WORDS;
+         ++i) {
+      size_t *cell = begin + i * words;
+      // free cells hold even links, dead objects of unswept blocks aren't marked
+      if (IS_FORWARDED(*(int *)cell)) { continue; }
+      if (sweep.block_swept[block] || bitmap_test(mark_bits, heap_word_index(cell))) { return cell; }
+    }
+  }
+  return heap.current;
+}
+
+void sweep_collect (size_t additional_size) {
+  memset(mark_bits, 0, bitmap_bytes(sweep.used_blocks * SWEEP_BLOCK_WORDS));
+  unsigned long long phase_start = now_ns();
+  mark_phase();
+  large_objects_sweep();
+  stats_phase_done(GC_PHASE_MARK, phase_start);
+
+  // blocks without survivors return to the pool at once, the others wait to be swept lazily
+  phase_start        = now_ns();
+  sweep.free_blocks  = SWEEP_NO_BLOCK;
+  sweep.class_blocks = 0;
+  sweep.live_words   = 0;
+  for (size_t c = 0; c < SWEEP_SIZE_CLASSES; ++c) {
+    sweep.free_cells[c] = NULL;
+    sweep.unswept[c]    = SWEEP_NO_BLOCK;
+  }
+  memset(sweep.block_swept, 0, sweep.used_blocks);
+  // lists are built from the end, so that lower blocks are used first
+  for (size_t block = sweep.used_blocks; block-- > 0;) {
+    size_t cells = sweep.block_class[block] == SWEEP_FREE_BLOCK ? 0 : sweep_block_live_cells(block);
+    if (cells == 0) {
+      sweep.block_class[block] = SWEEP_FREE_BLOCK;
+      sweep.block_next[block]  = sweep.free_blocks;
+      sweep.free_blocks        = block;
+      continue;
+    }
+    size_t c = sweep.block_class[block];
+    sweep.live_words += cells * sweep.class_words[c];
+    sweep.block_next[block] = sweep.unswept[c];
+    sweep.unswept[c]        = block;
+    ++sweep.class_blocks;
+  }
+  stats_phase_done(GC_PHASE_SWEEP, phase_start);
+
+  sweep.budget_blocks =
+      MAX(sweep.class_blocks * EXTRA_ROOM_HEAP_COEFFICIENT
+              + (additional_size + SWEEP_BLOCK_WORDS - 1) / SWEEP_BLOCK_WORDS,
+          SWEEP_MINIMUM_BLOCKS);
+  heap.size = sweep.budget_blocks * SWEEP_BLOCK_WORDS;
+}
+
+static void sweep_init (void) {
+  sweep_init_classes();
+  heap.begin   = reserve_heap_memory(WORDS_TO_BYTES(HEAP_MAX_WORDS));
+  heap.end     = heap.begin + HEAP_MAX_WORDS;
+  heap.current = heap.begin;
+  heap.size    = SWEEP_MINIMUM_BLOCKS * SWEEP_BLOCK_WORDS;
+  mark_bits    = reserve_memory(bitmap_bytes(HEAP_MAX_WORDS));
+
+  sweep.used_blocks   = 0;
+  sweep.budget_blocks = SWEEP_MINIMUM_BLOCKS;
+  sweep.class_blocks  = 0;
+  sweep.live_words    = 0;
+  sweep.free_blocks   = SWEEP_NO_BLOCK;
+  for (size_t c = 0; c < SWEEP_SIZE_CLASSES; ++c) {
+    sweep.free_cells[c] = NULL;
+    sweep.unswept[c]    = SWEEP_NO_BLOCK;
+  }
+  sweep.block_class = reserve_memory(SWEEP_MAX_BLOCKS);
+  sweep.block_swept = reserve_memory(SWEEP_MAX_BLOCKS);
+  sweep.block_next  = reserve_memory(SWEEP_MAX_BLOCKS * sizeof(size_t));
+}
+
+static void sweep_shutdown (void) {
+  munmap(heap.begin, WORDS_TO_BYTES(HEAP_MAX_WORDS));
+  munmap(mark_bits, bitmap_bytes(HEAP_MAX_WORDS));
+  mark_bits = NULL;
+  munmap(sweep.block_class, SWEEP_MAX_BLOCKS);
+  munmap(sweep.block_swept, SWEEP_MAX_BLOCKS);
+  munmap(sweep.block_next, SWEEP_MAX_BLOCKS * sizeof(size_t));
+  memset(&sweep, 0, sizeof(sweep));
+}
+
+/* Incremental marking of LISP2 heap */
+
+static inline bool incremental_is_black (void *obj) {
+  if (in_pointer_free_space(obj)) { return (size_t *)obj >= incremental.pointer_free_boundary; }
+  return (size_t *)obj >= incremental.boundary;
+}
+
+// colors a white object gray
+static void incremental_shade (void *obj) {
+  if (!is_valid_heap_pointer(obj)) {
+    if (is_large_object(obj) && large_object_mark(obj)) { mark_stack_push(&gray_objects, obj); }
+    return;
+  }
+  if (incremental_is_black(obj) || is_marked(obj)) { return; }
+  mark_object(obj);
+  if (!in_pointer_free_space(obj)) { mark_stack_push(&gray_objects, obj); }
+}
+
+static void incremental_shade_slot (void **slot) { incremental_shade(*slot); }
+
+void gc_satb_record (void *old_value) { incremental_shade(old_value); }
+
+void gc_start_incremental_marking (void) {
+  if (incremental.started) { return; }
+  unsigned long long start          = now_ns();
+  incremental.started               = true;
+  incremental.boundary              = heap.current;
+  incremental.pointer_free_boundary = pointer_free.current;
+  incremental.credit                = 0;
+  gc_marking_in_progress            = true;
+  visit_root_slots(incremental_shade_slot);
+  stats_phase_done(GC_PHASE_MARK, start);
+  stats_pause(now_ns() - start);
+}
+
+// blackens gray objects until `budget` words are scanned, finishes marking if no gray objects are left
+static void incremental_mark_slice (size_t budget) {
+  while (!mark_stack_is_empty(&gray_objects)) {
+    if (budget == 0) { return; }
+    void *header_ptr = get_obj_header_ptr(mark_stack_pop(&gray_objects));
+    for (obj_field_iterator field_it = ptr_field_begin_iterator(header_ptr);
+         !field_is_done_iterator(&field_it);
+         obj_next_ptr_field_iterator(&field_it)) {
+      incremental_shade(*(void **)field_it.cur_field);
+    }
+    budget -= MIN(budget, BYTES_TO_WORDS(obj_size_header_ptr(header_ptr)));
+  }
+  gc_marking_in_progress = false;
+}
+
+static void incremental_step (size_t allocated_words) {
+  if (!incremental.started) {
+    if ((heap.current - heap.begin + allocated_words) * 100
+        >= heap.size * INCREMENTAL_START_OCCUPANCY) {
+      gc_start_incremental_marking();
+    }
+    return;
+  }
+  // when marking is completed, compaction waits for the heap to be exhausted
+  if (!gc_marking_in_progress) { return; }
+  incremental.credit += allocated_words * INCREMENTAL_MARK_RATE;
+  if (incremental.credit < incremental.slice_words) { return; }
+  incremental.credit -= incremental.slice_words;
+
+  unsigned long long start = now_ns();
+  incremental_mark_slice(incremental.slice_words);
+  ++stats.mark_slices;
+  stats_phase_done(GC_PHASE_MARK, start);
+  stats_pause(now_ns() - start);
+}
+
+// completes the cycle before compaction: remaining gray objects are scanned and objects allocated after
+// the snapshot get their mark bits
+static void incremental_finish_marking (void) {
+  incremental_mark_slice(SIZE_MAX);
+  for (heap_iterator it = {incremental.boundary}; !heap_is_done_iterator(&it);
+       heap_next_obj_iterator(&it)) {
+    mark_object(get_object_content_ptr(it.current));
+  }
+  for (size_t *header = incremental.pointer_free_boundary; header < pointer_free.current;
+       header += BYTES_TO_WORDS(obj_size_header_ptr(header))) {
+    mark_object(get_object_content_ptr(header));
+  }
+  // stack slots recorded by the snapshot are stale, update_references needs current ones
+  gc_collect_stack_slots();
+  incremental.started = false;
+}
+
+/* Allocation-site profiling */
+
+static size_t alloc_site_hash (size_t offset, lama_type type, int tag) {
+  return (offset * 2654435761u) ^ ((size_t)tag * 40503u) ^ type;
+}
+
+static void alloc_profile_rehash (size_t index_capacity) {
+  free(profile.index);
+  profile.index_capacity = index_capacity;
+  profile.index          = calloc(index_capacity, sizeof(unsigned short));
+  if (profile.index == NULL) {
+    perror("ERROR: alloc_profile_rehash: calloc failed\n");
+    exit(1);
+  }
+  for (size_t i = 0; i < profile.number; ++i) {
+    alloc_site *s = &profile.sites[i];
+    size_t      h = alloc_site_hash(s->offset, s->type, s->tag) & (index_capacity - 1);
+    while (profile.index[h] != 0) { h = (h + 1) & (index_capacity - 1); }
+    profile.index[h] = i + 1;
+  }
+}
+
+// returns number of the site, creating it if needed; the last site takes everything past the limit
+static size_t alloc_profile_site (size_t offset, lama_type type, int tag) {
+  size_t mask = profile.index_capacity - 1;
+  size_t h    = alloc_site_hash(offset, type, tag) & mask;
+  for (; profile.index[h] != 0; h = (h + 1) & mask) {
+    alloc_site *s = &profile.sites[profile.index[h] - 1];
+    if (s->offset == offset && s->type == type && s->tag == tag) { return profile.index[h] - 1; }
+  }
+  if (profile.number == ALLOC_PROFILE_MAX_SITES) { return ALLOC_PROFILE_MAX_SITES - 1; }
+  if (profile.number == profile.capacity) {
+    profile.capacity = MAX(profile.capacity * 2, 64);
+    profile.sites    = realloc(profile.sites, profile.capacity * sizeof(alloc_site));
+    if (profile.sites == NULL) {
+      perror("ERROR: alloc_profile_site: realloc failed\n");
+      exit(1);
+    }
+  }
+  profile.sites[profile.number] = (alloc_site) {offset, type, tag, 0, 0, 0};
+  profile.index[h]              = ++profile.number;
+  if (profile.number * 2 > profile.index_capacity) {
+    alloc_profile_rehash(profile.index_capacity * 2);
+  }
+  return profile.number - 1;
+}
+
+// the type and the tag of an object are known only after `alloc` returns, so the latest allocation is
+// attributed to its site by the next one (the object can't be moved in between)
+static void alloc_profile_attribute_last (void) {
+  if (profile.last == NULL) { return; }
+  size_t   *header = profile.last;
+  lama_type type   = get_type_header_ptr(header);
+  int       tag    = type == SEXP ? ((sexp *)header)->tag : 0;
+  size_t    site   = alloc_profile_site(profile.last_site, type, tag);
+  ++profile.sites[site].objects;
+  profile.sites[site].bytes += profile.last_bytes;
+  if ((header >= heap.begin && header < heap.end) || in_pointer_free_space(header)) {
+    profile.object_sites[heap_word_index(header)] = site;
+  } else {
+    large.objects[large_object_lower_bound(header)].site = site;
+  }
+  profile.last = NULL;
+}
+
+// called for every object which survives a collection before it is moved to its new place
+static void alloc_profile_move (void *from, void *to) {
+  unsigned short site = profile.object_sites[heap_word_index(from)];
+  if (!(site & ALLOC_SITE_SURVIVED)) {
+    ++profile.sites[site].survived;
+    site |= ALLOC_SITE_SURVIVED;
+  }
+  profile.object_sites[heap_word_index(to)] = site;
+}
+
+const alloc_site *gc_alloc_profile_sites (size_t *number) {
+  alloc_profile_attribute_last();
+  *number = profile.number;
+  return profile.sites;
+}
+
+static const char *type_name (lama_type type) {
+  switch (type) {
+    case ARRAY: return "ARRAY";
+    case CLOSURE: return "CLOSURE";
+    case STRING: return "STRING";
+    case SEXP: return "SEXP";
+  }
+  return "UNKNOWN";
+}
+
+static int alloc_site_compare_bytes (const void *a, const void *b) {
+  unsigned long long x = ((const alloc_site *)a)->bytes, y = ((const alloc_site *)b)->bytes;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+extern char *de_hash (int);
+
+void gc_alloc_profile_dump (FILE *f) {
+  alloc_profile_attribute_last();
+  alloc_site *sorted = malloc(MAX(profile.number, 1) * sizeof(alloc_site));
+  if (sorted == NULL) {
+    perror("ERROR: gc_alloc_profile_dump: malloc failed\n");
+    exit(1);
+  }
+  memcpy(sorted, profile.sites, profile.number * sizeof(alloc_site));
+  qsort(sorted, profile.number, sizeof(alloc_site), alloc_site_compare_bytes);
+  fprintf(f, "%-10s %-8s %-6s %12s %16s %12s\n", "offset", "type", "tag", "objects", "bytes", "survived");
+  for (size_t i = 0; i < profile.number; ++i) {
+    alloc_site *s = &sorted[i];
+    fprintf(f,
+            "%#-10zx %-8s %-6s %12zu %16llu %12zu\n",
+            s->offset,
+            type_name(s->type),
+            s->type == SEXP ? de_hash(s->tag) : "-",
+            s->objects,
+            s->bytes,
+            s->survived);
+  }
+  free(sorted);
+}
+
+static void alloc_profile_dump_to_path (void) {
+  FILE *f = fopen(profile.path, "w");
+  if (f == NULL) {
+    perror("ERROR: alloc_profile_dump_to_path: fopen failed\n");
+    return;
+  }
+  gc_alloc_profile_dump(f);
+  fclose(f);
+}
+
+void gc_set_alloc_profile (const char *path) {
+  if (path != NULL && mode != GC_MODE_LISP2) {
+    fprintf(stderr, "ERROR: gc_set_alloc_profile: only lisp2 heap allocations can be profiled\n");
+    exit(1);
+  }
+  profile.path = path;
+}
+
+static void alloc_profile_init (void) {
+  profile.number = 0;
+  profile.last   = NULL;
+  alloc_profile_rehash(256);
+  profile.object_sites =
+      reserve_memory((HEAP_MAX_WORDS + POINTER_FREE_MAX_WORDS) * sizeof(unsigned short));
+}
+
+static void alloc_profile_shutdown (void) {
+  munmap(profile.object_sites, (HEAP_MAX_WORDS + POINTER_FREE_MAX_WORDS) * sizeof(unsigned short));
+  profile.object_sites = NULL;
+  profile.last         = NULL;
+}
+
+/* Heap census */
+
+static void census_table_rehash (census_table *t, size_t index_capacity) {
+  free(t->index);
+  t->index_capacity = index_capacity;
+  t->index          = calloc(index_capacity, sizeof(size_t));
+  if (t->index == NULL) {
+    perror("ERROR: census_table_rehash: calloc failed\n");
+    exit(1);
+  }
+  for (size_t i = 0; i < t->number; ++i) {
+    size_t h = (t->entries[i].key * 2654435761u) & (index_capacity - 1);
+    while (t->index[h] != 0) { h = (h + 1) & (index_capacity - 1); }
+    t->index[h] = i + 1;
+  }
+}
+
+static void census_table_add (census_table *t, size_t key, size_t bytes) {
+  if (t->index_capacity == 0) { census_table_rehash(t, 64); }
+  size_t mask = t->index_capacity - 1;
+  size_t h    = (key * 2654435761u) & mask;
+  for (; t->index[h] != 0; h = (h + 1) & mask) {
+    census_entry *e = &t->entries[t->index[h] - 1];
+    if (e->key == key) {
+      ++e->objects;
+      e->bytes += bytes;
+      return;
+    }
+  }
+  if (t->number == t->capacity) {
+    t->capacity = MAX(t->capacity * 2, 16);
+    t->entries  = realloc(t->entries, t->capacity * sizeof(census_entry));
+    if (t->entries == NULL) {
+      perror("ERROR: census_table_add: realloc failed\n");
+      exit(1);
+    }
+  }
+  t->entries[t->number] = (census_entry) {key, 1, bytes};
+  t->index[h]           = ++t->number;
+  if (t->number * 2 > t->index_capacity) { census_table_rehash(t, t->index_capacity * 2); }
+}
+
+static void census_table_clear (census_table *t) {
+  t->number = 0;
+  if (t->index != NULL) { memset(t->index, 0, t->index_capacity * sizeof(size_t)); }
+}
+
+static void census_count (void *header_ptr) {
+  lama_type type  = get_type_header_ptr(header_ptr);
+  size_t    bytes = obj_size_header_ptr(header_ptr);
+  size_t    len   = LEN(*(int *)header_ptr);
+  ++census.objects[type];
+  census.bytes[type] += bytes;
+  switch (type) {
+    case ARRAY: {
+      size_t bucket = 0;
+      for (; len != 0 && bucket < CENSUS_ARRAY_LENGTH_BUCKETS - 1; len >>= 1) { ++bucket; }
+      ++census.array_lengths[bucket];
+      break;
+    }
+    case SEXP: census_table_add(&census.sexp_tags, ((sexp *)header_ptr)->tag, bytes); break;
+    case CLOSURE: {
+      size_t entry = *(size_t *)get_object_content_ptr(header_ptr);
+      census_table_add(&census.closure_entries, entry - gc_census_code_base, bytes);
+      break;
+    }
+    case STRING: break;
+  }
+}
+
+const heap_census *gc_take_heap_census (void) {
+  gc_alloc(0);
+  memset(census.objects, 0, sizeof(census.objects));
+  memset(census.bytes, 0, sizeof(census.bytes));
+  memset(census.array_lengths, 0, sizeof(census.array_lengths));
+  census_table_clear(&census.sexp_tags);
+  census_table_clear(&census.closure_entries);
+  if (mode == GC_MODE_MARK_REGION) {
+    // the heap can't be walked linearly, objects marked by the collection are live
+    size_t words = region.used_blocks * REGION_BLOCK_WORDS;
+    for (size_t w = 0; w < words; ++w) {
+      if (region_is_marked(heap.begin + w)) { census_count(heap.begin + w); }
+    }
+  } else if (mode == GC_MODE_MARK_SWEEP) {
+    for (size_t *header = sweep_next_object(heap.begin); header < heap.current;
+         header         = sweep_next_object(header + 1)) {
+      census_count(header);
+    }
+  } else {
+    // only live objects are left in the heap after the collection
+    for (heap_iterator it = heap_begin_iterator(); !heap_is_done_iterator(&it);
+         heap_next_obj_iterator(&it)) {
+      census_count(it.current);
+    }
+    for (size_t *header = pointer_free.begin; header < pointer_free.current;
+         header += BYTES_TO_WORDS(obj_size_header_ptr(header))) {
+      census_count(header);
+    }
+  }
+  for (size_t i = 0; i < large.number; ++i) { census_count(large.objects[i].header); }
+  return &census;
+}
+
+static int census_entry_compare_bytes (const void *a, const void *b) {
+  size_t x = ((const census_entry *)a)->bytes, y = ((const census_entry *)b)->bytes;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// sorts entries by size, the table is rebuilt to keep the index valid
+static void census_table_sort (census_table *t) {
+  qsort(t->entries, t->number, sizeof(census_entry), census_entry_compare_bytes);
+  if (t->index != NULL) { census_table_rehash(t, t->index_capacity); }
+}
+
+void gc_heap_census_dump (FILE *f) {
+  gc_take_heap_census();
+  census_table_sort(&census.sexp_tags);
+  census_table_sort(&census.closure_entries);
+  fprintf(f, "{\n  \"types\": {");
+  for (lama_type t = ARRAY; t <= SEXP; ++t) {
+    fprintf(f,
+            "%s\n    \"%s\": {\"objects\": %zu, \"bytes\": %zu}",
+            t == ARRAY ? "" : ",",
+            type_name(t),
+            census.objects[t],
+            census.bytes[t]);
+  }
+  fprintf(f, "\n  },\n  \"array_lengths\": [");
+  bool first = true;
+  for (int i = 0; i < CENSUS_ARRAY_LENGTH_BUCKETS; ++i) {
+    if (census.array_lengths[i] == 0) { continue; }
+    fprintf(f,
+            "%s{\"below\": %zu, \"objects\": %zu}",
+            first ? "" : ", ",
+            (size_t)1 << i,
+            census.array_lengths[i]);
+    first = false;
+  }
+  fprintf(f, "],\n  \"sexp_tags\": [");
+  for (size_t i = 0; i < census.sexp_tags.number; ++i) {
+    census_entry *e = &census.sexp_tags.entries[i];
+    fprintf(f,
+            "%s\n    {\"tag\": \"%s\", \"objects\": %zu, \"bytes\": %zu}",
+            i ? "," : "",
+            de_hash(e->key),
+            e->objects,
+            e->bytes);
+  }
+  fprintf(f, "%s],\n  \"closure_entries\": [", census.sexp_tags.number ? "\n  " : "");
+  for (size_t i = 0; i < census.closure_entries.number; ++i) {
+    census_entry *e = &census.closure_entries.entries[i];
+    fprintf(f,
+            "%s\n    {\"offset\": \"%#zx\", \"objects\": %zu, \"bytes\": %zu}",
+            i ? "," : "",
+            e->key,
+            e->objects,
+            e->bytes);
+  }
+  fprintf(f, "%s]\n}\n", census.closure_entries.number ? "\n  " : "");
+}
+
+static void gc_heap_census_dump_to_path (void) {
+  census_dump_requested = 0;
+  FILE *f               = fopen(census_path, "w");
+  if (f == NULL) {
+    perror("ERROR: gc_heap_census_dump_to_path: fopen failed\n");
+    return;
+  }
+  gc_heap_census_dump(f);
+  fclose(f);
+}
+
+static void census_signal_handler (int sig) {
+  (void)sig;
+  census_dump_requested = 1;
+}
+
+void gc_set_incremental_marking (size_t slice_words) {
+  if (slice_words != 0 && mode != GC_MODE_LISP2) {
+    fprintf(stderr, "ERROR: gc_set_incremental_marking: only lisp2 heap can be marked incrementally\n");
+    exit(1);
+  }
+  incremental.slice_words = slice_words;
+}
+
+static void region_init (void) {
+  size_t words = (size_t)REGION_MAX_BLOCKS * REGION_BLOCK_WORDS;
+  heap.begin   = reserve_heap_memory(WORDS_TO_BYTES(words));
+  heap.end     = heap.begin + words;
+  heap.current = heap.begin;
+  heap.size    = REGION_MINIMUM_BLOCKS * REGION_BLOCK_WORDS;
+
+  region.used_blocks        = 0;
+  region.occupied_blocks    = 0;
+  region.free_blocks_number = 0;
+  region.evacuation_reserve = 0;
+  region.budget_blocks      = REGION_MINIMUM_BLOCKS;
+  region.cursor             = NULL;
+  region.limit              = NULL;
+  region.next_line          = 0;
+  region.evacuation_cursor  = NULL;
+  region.evacuation_limit   = NULL;
+  region.live_lines         = reserve_memory(REGION_MAX_BLOCKS * REGION_LINES_PER_BLOCK);
+  region.block_live_lines   = reserve_memory(REGION_MAX_BLOCKS * sizeof(unsigned short));
+  region.evacuate           = reserve_memory(REGION_MAX_BLOCKS);
+  region.free_blocks        = reserve_memory(REGION_MAX_BLOCKS * sizeof(size_t));
+  region.mark_bits          = reserve_memory(words / 8);
+}
+
+static void region_shutdown (void) {
+  size_t words = (size_t)REGION_MAX_BLOCKS * REGION_BLOCK_WORDS;
+  munmap(heap.begin, WORDS_TO_BYTES(words));
+  munmap(region.live_lines, REGION_MAX_BLOCKS * REGION_LINES_PER_BLOCK);
+  munmap(region.block_live_lines, REGION_MAX_BLOCKS * sizeof(unsigned short));
+  munmap(region.evacuate, REGION_MAX_BLOCKS);
+  munmap(region.free_blocks, REGION_MAX_BLOCKS * sizeof(size_t));
+  munmap(region.mark_bits, words / 8);
+  mark_stack_free(&region_mark_stack);
+  memset(&region, 0, sizeof(region));
+}
+
+void gc_set_mode (gc_mode m) { mode = m; }
+
+void gc_set_compaction_order (gc_order order) { compaction_order = order; }
+
+gc_mode gc_get_mode (void) { return mode; }
+
+static void select_mode_from_env (void) {
+  const char *name = getenv("YAILAMA_GC");
+  if (name == NULL) { return; }
+  if (strcmp(name, "lisp2") == 0) {
+    mode = GC_MODE_LISP2;
+  } else if (strcmp(name, "mark-region") == 0) {
+    mode = GC_MODE_MARK_REGION;
+  } else if (strcmp(name, "semispace") == 0) {
+    mode = GC_MODE_SEMISPACE;
+  } else if (strcmp(name, "mark-sweep") == 0) {
+    mode = GC_MODE_MARK_SWEEP;
+  } else {
+    fprintf(stderr, "ERROR: __gc_init: unknown GC mode '%s' in YAILAMA_GC\n", name);
+    exit(1);
+  }
+}
+
+static void compaction_order_setup_from_env (void) {
+  const char *name = getenv("YAILAMA_GC_ORDER");
+  if (name == NULL) { return; }
+  if (strcmp(name, "address") == 0) {
+    compaction_order = GC_ORDER_ADDRESS;
+  } else if (strcmp(name, "depth-first") == 0) {
+    compaction_order = GC_ORDER_DEPTH_FIRST;
+  } else if (strcmp(name, "hierarchical") == 0) {
+    compaction_order = GC_ORDER_HIERARCHICAL;
+  } else {
+    fprintf(stderr, "ERROR: __gc_init: unknown compaction order '%s' in YAILAMA_GC_ORDER\n", name);
+    exit(1);
+  }
+}
+
+static void incremental_setup_from_env (void) {
+  const char *slice = getenv("YAILAMA_GC_MARK_SLICE");
+  if (slice == NULL) { return; }
+  char *end;
+  long  words = strtol(slice, &end, 10);
+  if (*slice == '\0' || *end != '\0' || words <= 0) {
+    fprintf(stderr, "ERROR: __gc_init: YAILAMA_GC_MARK_SLICE must be a positive number of words\n");
+    exit(1);
+  }
+  gc_set_incremental_marking(words);
+}
+
+static void huge_pages_setup_from_env (void) {
+  const char *enabled = getenv("YAILAMA_GC_HUGE_PAGES");
+  gc_set_huge_pages(enabled != NULL && strcmp(enabled, "0") != 0);
+}
+
+static void alloc_profile_setup_from_env (void) {
+  const char *path = getenv("YAILAMA_ALLOC_PROFILE");
+  if (path == NULL) { return; }
+  gc_set_alloc_profile(path);
+  atexit(alloc_profile_dump_to_path);
+}
+
+static void census_setup_from_env (void) {
+  census_path = getenv("YAILAMA_HEAP_CENSUS");
+  if (census_path == NULL) { return; }
+  signal(GC_CENSUS_SIGNAL, census_signal_handler);
+  atexit(gc_heap_census_dump_to_path);
+}
+
+static void stats_setup_from_env (void) {
+  stats_path = getenv("YAILAMA_GC_STATS");
+  if (stats_path == NULL) { return; }
+  signal(GC_STATS_SIGNAL, stats_signal_handler);
+  atexit(gc_stats_dump_to_path);
+}
+
 void __gc_init (void) {
   __gc_stack_bottom = (size_t)__builtin_frame_address(1) + 4;
+  select_mode_from_env();
+  compaction_order_setup_from_env();
+  incremental_setup_from_env();
+  huge_pages_setup_from_env();
+  alloc_profile_setup_from_env();
+  census_setup_from_env();
+  stats_setup_from_env();
   __init();
 }
 
@@ -570,20 +2359,75 @@ void __init (void) {
 
   srandom(time(NULL));
 
-  heap.begin = mmap(
-      NULL, space_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
-  if (heap.begin == MAP_FAILED) {
-    perror("ERROR: __init: mmap failed\n");
-    exit(1);
-  }
-  heap.end     = heap.begin + INIT_HEAP_SIZE;
-  heap.size    = INIT_HEAP_SIZE;
-  heap.current = heap.begin;
   clear_extra_roots();
+  stack_slots.size       = 0;
+  stack_slots_bottom     = NULL;
+  heap_shrink.streak         = 0;
+  pointer_free_shrink.streak = 0;
+  pointer_free               = (memory_chunk) {NULL, NULL, NULL, 0};
+  gray_objects.size      = 0;
+  incremental.started    = false;
+  gc_marking_in_progress = false;
+  if (mode == GC_MODE_MARK_REGION) {
+    region_init();
+    return;
+  }
+  if (mode == GC_MODE_MARK_SWEEP) {
+    sweep_init();
+    return;
+  }
+
+  if (mode == GC_MODE_LISP2) {
+    // the heap never moves, it only grows and shrinks within the reservation; the pointer-free space
+    // follows it in the same reservation, so both share the mark bitmap
+    heap.begin           = reserve_heap_memory(WORDS_TO_BYTES(HEAP_MAX_WORDS + POINTER_FREE_MAX_WORDS));
+    mark_bits            = reserve_memory(bitmap_bytes(HEAP_MAX_WORDS + POINTER_FREE_MAX_WORDS));
+    live_bits            = reserve_memory(bitmap_bytes(HEAP_MAX_WORDS + POINTER_FREE_MAX_WORDS));
+    offset_table         = reserve_memory(
+        WORDS_TO_BYTES((HEAP_MAX_WORDS + POINTER_FREE_MAX_WORDS) / COMPACT_BLOCK_WORDS));
+    pointer_free.begin   = heap.begin + HEAP_MAX_WORDS;
+    pointer_free.current = pointer_free.begin;
+    pointer_free.size    = INIT_HEAP_SIZE;
+    pointer_free.end     = pointer_free.begin + pointer_free.size;
+    if (profile.path != NULL) { alloc_profile_init(); }
+  } else {
+    heap.begin = mmap(
+        NULL, space_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    if (heap.begin == MAP_FAILED) {
+      perror("ERROR: __init: mmap failed\n");
+      exit(1);
+    }
+  }
+  heap.end           = heap.begin + INIT_HEAP_SIZE;
+  heap.size          = INIT_HEAP_SIZE;
+  heap.current       = heap.begin;
+  semispace_reserved = INIT_HEAP_SIZE;
 }
 
 extern void __shutdown (void) {
-  munmap(heap.begin, heap.size);
+  switch (mode) {
+    case GC_MODE_MARK_REGION: region_shutdown(); break;
+    case GC_MODE_MARK_SWEEP: sweep_shutdown(); break;
+    case GC_MODE_SEMISPACE: munmap(heap.begin, WORDS_TO_BYTES(semispace_reserved)); break;
+    case GC_MODE_LISP2:
+      munmap(heap.begin, WORDS_TO_BYTES(HEAP_MAX_WORDS + POINTER_FREE_MAX_WORDS));
+      munmap(mark_bits, bitmap_bytes(HEAP_MAX_WORDS + POINTER_FREE_MAX_WORDS));
+      munmap(live_bits, bitmap_bytes(HEAP_MAX_WORDS + POINTER_FREE_MAX_WORDS));
+      munmap(offset_table,
+             WORDS_TO_BYTES((HEAP_MAX_WORDS + POINTER_FREE_MAX_WORDS) / COMPACT_BLOCK_WORDS));
+      pointer_free = (memory_chunk) {NULL, NULL, NULL, 0};
+      mark_bits    = NULL;
+      live_bits    = NULL;
+      offset_table = NULL;
+      if (profile.path != NULL) { alloc_profile_shutdown(); }
+      break;
+  }
+  mark_stack_free(&stack_slots);
+  stack_slots_bottom = NULL;
+  mark_stack_free(&gray_objects);
+  incremental.started    = false;
+  gc_marking_in_progress = false;
+  large_objects_free();
 #ifdef DEBUG_VERSION
   cur_id = 0;
 #endif
@@ -625,20 +2469,47 @@ void pop_extra_root (void **p) {
 size_t objects_snapshot (int *object_ids_buf, size_t object_ids_buf_size) {
   size_t *ids_ptr = (size_t *)object_ids_buf;
   size_t  i       = 0;
-  for (heap_iterator it = heap_begin_iterator();
-       !heap_is_done_iterator(&it) && i < object_ids_buf_size;
-       heap_next_obj_iterator(&it), ++i) {
-    void *header_ptr = it.current;
-    data *d          = TO_DATA(get_object_content_ptr(header_ptr));
-    ids_ptr[i]       = d->id;
+  if (mode == GC_MODE_MARK_REGION) {
+    // the heap can't be walked linearly, objects marked by the last collection are reported instead
+    size_t words = region.used_blocks * REGION_BLOCK_WORDS;
+    for (size_t w = 0; w < words && i < object_ids_buf_size; ++w) {
+      if (region_is_marked(heap.begin + w)) { ids_ptr[i++] = ((data *)(heap.begin + w))->id; }
+    }
+    return i;
+  }
+  if (mode == GC_MODE_MARK_SWEEP) {
+    for (size_t *header = sweep_next_object(heap.begin);
+         header < heap.current && i < object_ids_buf_size;
+         header = sweep_next_object(header + 1)) {
+      ids_ptr[i++] = ((data *)header)->id;
+    }
+    for (size_t j = 0; j < large.number && i < object_ids_buf_size; ++j) {
+      ids_ptr[i++] = ((data *)large.objects[j].header)->id;
+    }
+    return i;
+  }
+  // objects of the heap and of the pointer-free space are merged in allocation order
+  heap_iterator it     = heap_begin_iterator();
+  size_t       *header = pointer_free.begin;
+  for (; i < object_ids_buf_size; ++i) {
+    bool heap_done = heap_is_done_iterator(&it), pointer_free_done = header >= pointer_free.current;
+    if (heap_done && pointer_free_done) { break; }
+    if (pointer_free_done || (!heap_done && ((data *)it.current)->id < ((data *)header)->id)) {
+      ids_ptr[i] = ((data *)it.current)->id;
+      heap_next_obj_iterator(&it);
+    } else {
+      ids_ptr[i] = ((data *)header)->id;
+      header += BYTES_TO_WORDS(obj_size_header_ptr(header));
+    }
+  }
+  for (size_t j = 0; j < large.number && i < object_ids_buf_size; ++j, ++i) {
+    ids_ptr[i] = ((data *)large.objects[j].header)->id;
   }
   return i;
 }
 #endif
 
 #ifdef DEBUG_VERSION
-extern char *de_hash (int);
-
 void dump_heap () {
   size_t i = 0;
   for (heap_iterator it = heap_begin_iterator(); !heap_is_done_iterator(&it);
@@ -673,44 +2544,24 @@ void set_extra_roots (size_t extra_roots_size, void **extra_roots_ptr) {
 /* Utility functions */
 
 size_t get_forward_address (void *obj) {
-  data *d = TO_DATA(obj);
-  return GET_FORWARD_ADDRESS(d->forward_address);
+  size_t *header = (size_t *)TO_DATA(obj);
+  if (forwarding != NULL && !in_pointer_free_space(header)) {
+    return (size_t)forwarding[heap_word_index(header)];
+  }
+  return (size_t)compressed_address(header);
 }
 
 void set_forward_address (void *obj, size_t addr) {
-  data *d = TO_DATA(obj);
-  SET_FORWARD_ADDRESS(d->forward_address, addr);
+  forwarding[heap_word_index(TO_DATA(obj))] = (size_t *)addr;
 }
 
-bool is_marked (void *obj) {
-  data *d        = TO_DATA(obj);
-  int   mark_bit = GET_MARK_BIT(d->forward_address);
-  return mark_bit;
-}
+bool is_marked (void *obj) { return bitmap_test(mark_bits, heap_word_index(TO_DATA(obj))); }
 
-void mark_object (void *obj) {
-  data *d = TO_DATA(obj);
-  SET_MARK_BIT(d->forward_address);
-}
+void mark_object (void *obj) { bitmap_set(mark_bits, heap_word_index(TO_DATA(obj))); }
 
 void unmark_object (void *obj) {
-  data *d = TO_DATA(obj);
-  RESET_MARK_BIT(d->forward_address);
-}
-
-bool is_enqueued (void *obj) {
-  data *d = TO_DATA(obj);
-  return IS_ENQUEUED(d->forward_address) != 0;
-}
-
-void make_enqueued (void *obj) {
-  data *d = TO_DATA(obj);
-  MAKE_ENQUEUED(d->forward_address);
-}
-
-void make_dequeued (void *obj) {
-  data *d = TO_DATA(obj);
-  MAKE_DEQUEUED(d->forward_address);
+  size_t i = heap_word_index(TO_DATA(obj));
+  mark_bits[i / BITS_PER_WORD] &= ~((size_t)1 << (i % BITS_PER_WORD));
 }
 
 heap_iterator heap_begin_iterator () {
@@ -868,7 +2719,7 @@ size_t get_header_size (lama_type type) {
 }
 
 void *alloc_string (int len) {
-  data *obj        = alloc(string_size(len));
+  data *obj        = alloc_object(string_size(len), true);
   obj->data_header = STRING_TAG | (len << 3);
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "%p, [STRING] tag=%zu\n", obj, TAG(obj->data_header));
@@ -876,7 +2727,6 @@ void *alloc_string (int len) {
 #ifdef DEBUG_VERSION
   obj->id = cur_id;
 #endif
-  obj->forward_address = 0;
   return obj;
 }
 
@@ -889,7 +2739,6 @@ void *alloc_array (int len) {
 #ifdef DEBUG_VERSION
   obj->id = cur_id;
 #endif
-  obj->forward_address = 0;
   return obj;
 }
 
@@ -902,8 +2751,7 @@ void *alloc_sexp (int members) {
 #ifdef DEBUG_VERSION
   obj->id = cur_id;
 #endif
-  obj->forward_address = 0;
-  obj->tag             = 0;
+  obj->tag = 0;
   return obj;
 }
 
@@ -917,6 +2765,5 @@ void *alloc_closure (int captured) {
 #ifdef DEBUG_VERSION
   obj->id = cur_id;
 #endif
-  obj->forward_address = 0;
   return obj;
 }
@@ -11,32 +11,36 @@
 //  - void *gc_alloc (size_t): this function is basically called whenever we are
 // not able to allocate memory on the existing heap via simple bump allocator.
 //  - mark_phase(): this function will tell you everything you need to know
-// about marking. I would also recommend to pay attention to the fact that
-// marking is implemented without usage of any additional memory. Already
-// allocated space is sufficient (for details see 'void mark (void *obj)').
+// about marking. Mark bits are kept in a bitmap aside of the heap (one bit per
+// heap word), objects waiting to be scanned are kept on an explicit stack and
+// are prefetched shortly before they are scanned.
 //  - void compact_phase (size_t additional_size): the whole compaction phase
 // can be understood by looking at this piece of code plus couple of other
-// functions used in there. It is basically an implementation of LISP2.
+// functions used in there. It is based on LISP2, but as in the Compressor no
+// forwarding addresses are stored: `compute_locations` builds a bitmap of live
+// words and a per-block offset table, new addresses are computed from them on
+// demand, and fields are fixed in the same pass that slides objects.
 
 #ifndef __LAMA_GC__
 #define __LAMA_GC__
 
 #include "runtime_common.h"
 
-#define GET_MARK_BIT(x) (((int)(x)) & 1)
-#define SET_MARK_BIT(x) (x = (((int)(x)) | 1))
-#define IS_ENQUEUED(x) (((int)(x)) & 2)
-#define MAKE_ENQUEUED(x) (x = (((int)(x)) | 2))
-#define MAKE_DEQUEUED(x) (x = (((int)(x)) & (~2)))
-#define RESET_MARK_BIT(x) (x = (((int)(x)) & (~1)))
-// since last 2 bits are used for mark-bit and enqueued-bit and due to correct
-// alignment we can expect that last 2 bits don't influence address (they
-// should always be zero)
-#define GET_FORWARD_ADDRESS(x) (((size_t)(x)) & (~3))
-// take the last two bits as they are and make all others zero
-#define SET_FORWARD_ADDRESS(x, addr) (x = ((x & 3) | ((int)(addr))))
+// object headers carry no GC metadata: mark bits and forwarding addresses of LISP2 heap live in side
+// tables. A copying collector overwrites the header of an object it has moved with the address of the
+// copy's content. Headers of live objects have odd tags while addresses are word-aligned, so the lowest
+// bit tells a forwarded object apart
+#define IS_FORWARDED(header) ((((size_t)(header)) & 1) == 0)
 // if heap is full after gc shows in how many times it has to be extended
 #define EXTRA_ROOM_HEAP_COEFFICIENT 2
+// LISP2 heap reserves address space for this many words once, pages are committed on the first touch,
+// so the heap is never moved and can't grow past it
+#define HEAP_MAX_WORDS (1 << 27)   // 512 MiB
+// LISP2 heap grows as soon as a collection needs more room, but shrinks only after HEAP_SHRINK_CYCLES
+// collections in a row needed at most 1/HEAP_SHRINK_RATIO of it. Then it shrinks to the largest size
+// needed by those collections and pages past the new end are returned to the OS
+#define HEAP_SHRINK_RATIO 4
+#define HEAP_SHRINK_CYCLES 3
 #ifdef DEBUG_VERSION
 #  define MINIMUM_HEAP_CAPACITY (8)
 #else
@@ -45,6 +49,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 
 typedef enum { ARRAY, CLOSURE, STRING, SEXP } lama_type;
 
@@ -67,6 +72,45 @@ typedef struct {
 } memory_chunk;
 
 
+// ============================================================================
+//                              GC modes
+// ============================================================================
+// The heap can be managed by one of several collectors. The mode is chosen once
+// at startup: `__gc_init` reads it from the YAILAMA_GC environment variable,
+// tests call `gc_set_mode` before `__init`. It must not change while the heap
+// is alive.
+//  - GC_MODE_LISP2 ("lisp2", default): sliding mark-compact described above
+//  - GC_MODE_MARK_REGION ("mark-region"): Immix-style heap of blocks and lines,
+//    objects are not moved unless their block is sparsely occupied
+//  - GC_MODE_SEMISPACE ("semispace"): Cheney's copying collector, survivors are
+//    copied breadth-first into a fresh to-space and the old space is unmapped,
+//    forwarding pointers overwrite headers of old copies. Collection time depends
+//    on the live size only, which pays off when most allocated objects die young
+//  - GC_MODE_MARK_SWEEP ("mark-sweep"): non-moving, objects live in cells of
+//    size-segregated blocks and keep their addresses. Pauses consist of marking
+//    only: blocks without survivors are released right away, the others are
+//    swept lazily, one at a time, when their size class runs out of free cells
+typedef enum { GC_MODE_LISP2, GC_MODE_MARK_REGION, GC_MODE_SEMISPACE, GC_MODE_MARK_SWEEP } gc_mode;
+
+void    gc_set_mode (gc_mode mode);
+gc_mode gc_get_mode (void);
+
+// Order of survivors after a compaction of LISP2 heap, read from the YAILAMA_GC_ORDER
+// environment variable by `__gc_init`:
+//  - GC_ORDER_ADDRESS ("address", default): sliding, allocation order is kept
+//  - GC_ORDER_DEPTH_FIRST ("depth-first"): objects are laid out in the order of
+//    a depth-first traversal from the roots
+//  - GC_ORDER_HIERARCHICAL ("hierarchical"): the same traversal, but all children
+//    of an object are placed as soon as it is scanned, so list spines and tree
+//    children end up right next to their parents
+// Traversal orders copy survivors through a scratch area past the end of the
+// heap and then move them back in one block, so they fall back to the address
+// order if the heap takes more than half of its reservation.
+typedef enum { GC_ORDER_ADDRESS, GC_ORDER_DEPTH_FIRST, GC_ORDER_HIERARCHICAL } gc_order;
+
+void gc_set_compaction_order (gc_order order);
+
+
 // the only GC-related function that should be exposed, others are useful for tests and internal implementation
 // allocates object of the given size on the heap
 void *alloc(size_t);
@@ -86,10 +130,275 @@ void scan_global_area (void);
 #endif
 // takes number of words that are required to be allocated somewhere on the heap
 void compact_phase (size_t additional_size);
-// specific for Lisp-2 algorithm
+// specific for Lisp-2 algorithm, the pointer-free space is handled by the first and the last step only;
+// when objects slide, `update_references` fixes roots only and `physically_relocate` fixes the fields
+// of each survivor right before moving it
 size_t compute_locations ();
-void   update_references (memory_chunk *);
-void   physically_relocate (memory_chunk *);
+void   update_references (void);
+void   physically_relocate (void);
+
+
+// ============================================================================
+//                            Mark-region heap
+// ============================================================================
+// The heap is a single reserved address range split into blocks of lines.
+// Objects are bump-allocated into holes, i.e. runs of lines which held no live
+// data after the previous collection, and fresh blocks are taken only when no
+// hole fits. A collection marks live objects (and the lines they cover) tracing
+// from root slots, nothing is slid. Objects found in blocks that were sparsely
+// occupied after the previous collection are opportunistically evacuated into
+// other blocks, and the slot they were reached through is updated on the fly.
+// Blocks left without live data are kept on a free list and handed out whole,
+// for allocation and evacuation, before never used blocks are taken.
+#define REGION_LINE_WORDS 32   // 128-byte lines
+#define REGION_LINES_PER_BLOCK 256   // 32 KiB blocks
+#define REGION_BLOCK_WORDS (REGION_LINE_WORDS * REGION_LINES_PER_BLOCK)
+// size of the reserved range, the heap can never grow past it
+#define REGION_MAX_BLOCKS (1 << 14)
+// blocks with at most this many live lines are evacuated during the next collection
+#define REGION_EVACUATION_THRESHOLD (REGION_LINES_PER_BLOCK / 4)
+#define REGION_MINIMUM_BLOCKS 2
+
+// collects garbage of the mark-region heap, `additional_size` (in words) is the size of allocation that failed
+void region_collect (size_t additional_size);
+
+
+// ============================================================================
+//                             Mark-sweep heap
+// ============================================================================
+// The heap is a single reserved address range split into blocks, each block is
+// carved into cells of one size class. Free cells are linked into per-class
+// lists through their first word, which is even, while object headers are odd.
+// Marking is shared with LISP2 heap (the same roots, mark stack and bitmap).
+// Objects bigger than the largest class go to the large-object space.
+#define SWEEP_BLOCK_WORDS (1 << 13)   // 32 KiB blocks
+#define SWEEP_MAX_BLOCKS (HEAP_MAX_WORDS / SWEEP_BLOCK_WORDS)
+// classes are 1..8 words and then four per power of two up to the largest one
+#define SWEEP_MAX_CELL_WORDS (SWEEP_BLOCK_WORDS / 4)
+#define SWEEP_SIZE_CLASSES 40
+#define SWEEP_MINIMUM_BLOCKS 4
+
+// marks the mark-sweep heap and releases empty blocks, `additional_size` (in words) is the size of
+// allocation that failed
+void sweep_collect (size_t additional_size);
+
+
+// ============================================================================
+//                              Huge pages
+// ============================================================================
+// Linear heap walks suffer from TLB misses on 4 KiB pages. With huge pages
+// enabled (YAILAMA_GC_HUGE_PAGES=1, read by `__gc_init`) heap reservations of
+// LISP2 and mark-region heaps are aligned to HUGE_PAGE_SIZE and advised to be
+// backed by transparent huge pages. The kernel may still refuse, so statistics
+// report how much of the heap is actually backed by them.
+#define HUGE_PAGE_SIZE (1 << 21)
+
+// must be called before `__init`
+void gc_set_huge_pages (bool enabled);
+// advises huge pages for the given range if they are enabled, `begin` should be HUGE_PAGE_SIZE-aligned
+void gc_advise_huge_pages (void *begin, size_t bytes);
+
+
+// ============================================================================
+//                            GC statistics
+// ============================================================================
+// Counters are always collected. If YAILAMA_GC_STATS=<path> is set, `__gc_init`
+// arranges for them to be written to <path> as JSON at exit and whenever the
+// process receives GC_STATS_SIGNAL (the dump happens on the next allocation).
+// With huge pages enabled the dump includes the size of the heap backed by them
+// (AnonHugePages of the heap mapping, from /proc/self/smaps).
+#define GC_STATS_SIGNAL SIGUSR1
+// bucket i counts pauses shorter than 2^i microseconds (and not shorter than 2^(i-1))
+#define GC_PAUSE_HISTOGRAM_BUCKETS 32
+
+typedef enum {
+  GC_PHASE_MARK,
+  GC_PHASE_COMPUTE_LOCATIONS,
+  GC_PHASE_UPDATE_REFERENCES,
+  GC_PHASE_PHYSICALLY_RELOCATE,
+  GC_PHASE_COPY,
+  GC_PHASE_SWEEP,
+  GC_PHASES_NUMBER
+} gc_phase;
+
+typedef struct {
+  size_t             live_words;   // live data after the collection
+  size_t             heap_words;   // heap size after the collection
+  unsigned long long pause_ns;
+} gc_cycle_stats;
+
+typedef struct {
+  size_t             collections;
+  size_t             mark_slices;   // increments of incremental marking
+  unsigned long long allocated_bytes;
+  unsigned long long released_bytes;   // returned to the OS by heap shrinking
+  unsigned long long phase_ns[GC_PHASES_NUMBER];
+  unsigned long long total_pause_ns;
+  unsigned long long max_pause_ns;
+  size_t             pause_histogram[GC_PAUSE_HISTOGRAM_BUCKETS];
+  gc_cycle_stats    *cycles;   // one entry per collection
+  size_t             cycles_capacity;
+} gc_stats;
+
+const gc_stats *gc_get_stats (void);
+// writes statistics as JSON to `f`
+void gc_stats_dump (FILE *f);
+
+
+// ============================================================================
+//                           Large-object space
+// ============================================================================
+// With LISP2 heap objects of at least LARGE_OBJECT_WORDS words are allocated
+// outside of the heap, each in its own mapping. They are marked in place (the
+// mark bit is kept aside, in the space's table), never moved by compaction and
+// unmapped as soon as a collection finds them dead. A collection is triggered
+// when large objects grow past the budget, which is computed like the heap size
+// from the size of survivors.
+#define LARGE_OBJECT_WORDS (1 << 13)   // 32 KiB
+#define LARGE_OBJECT_MINIMUM_BUDGET (1 << 18)   // 1 MiB
+
+// takes a pointer to an object content, returns whether it is in the large-object space
+bool is_large_object (const void *obj);
+
+// takes a pointer to an object content, returns whether it is an object of the heap or of the
+// large-object space, i.e. whether the runtime may look inside it; the collector itself uses
+// `is_valid_heap_pointer`, which covers the heap only
+bool is_runtime_object (const void *obj);
+
+
+// ============================================================================
+//                           Pointer-free space
+// ============================================================================
+// With LISP2 heap strings, which carry no pointers, are allocated in a space of
+// their own placed right after the heap reservation. Marking only sets their
+// mark bits and never pushes them on the mark stack, reference updating doesn't
+// walk the space, and compaction slides survivors down following the mark
+// bitmap, so dead strings are never read. The space is sized like the heap, from
+// the size of survivors, and shrinks the same way.
+#define POINTER_FREE_MAX_WORDS (1 << 25)   // 128 MiB
+
+
+// ============================================================================
+//                          Incremental marking
+// ============================================================================
+// LISP2 heap can be marked incrementally to bound pauses by something smaller
+// than the live heap size. Once the heap is INCREMENTAL_START_OCCUPANCY percent
+// full, roots are shaded gray (snapshot) and then allocations pay for marking:
+// every allocated word earns INCREMENTAL_MARK_RATE words of marking work, which
+// is done in slices of `slice_words` words. Objects allocated after the snapshot
+// are black (they lie above the snapshot's heap top). Compaction is deferred
+// until the heap is exhausted, then the rest of marking is finished and the heap
+// is compacted as usual.
+// Snapshot-at-the-beginning invariant requires every store overwriting a
+// pointer inside a heap object to pass the old value to `gc_write_barrier`.
+// YAILAMA_GC_MARK_SLICE=<words> enables incremental marking in `__gc_init`.
+#define INCREMENTAL_START_OCCUPANCY 75
+#define INCREMENTAL_MARK_RATE 4
+
+extern bool gc_marking_in_progress;
+
+// 0 disables incremental marking
+void gc_set_incremental_marking (size_t slice_words);
+// takes the snapshot right away instead of waiting for the heap occupancy
+void gc_start_incremental_marking (void);
+void gc_satb_record (void *old_value);
+
+static inline void gc_write_barrier (void *old_value) {
+  if (gc_marking_in_progress) { gc_satb_record(old_value); }
+}
+
+
+// ============================================================================
+//                        Allocation-site profiling
+// ============================================================================
+// With YAILAMA_ALLOC_PROFILE=<path> (LISP2 heap only) every allocation is
+// attributed to the site stored in `gc_alloc_site` by the mutator: the
+// interpreter puts there the bytecode offset of the instruction it executes.
+// Sites are keyed by the offset, the object type and the sexp tag. For each of
+// them the number of objects, their size and the number of objects which
+// survived at least one collection are counted. Site of every heap object is
+// kept in a side table which moves along with objects during compaction. The
+// report, sorted by size, is written to <path> at exit.
+#define ALLOC_PROFILE_MAX_SITES (1 << 15)
+
+extern size_t gc_alloc_site;
+
+typedef struct {
+  size_t             offset;   // bytecode offset of the allocating instruction
+  lama_type          type;
+  int                tag;   // sexp tag, 0 for other types
+  size_t             objects;
+  unsigned long long bytes;
+  size_t             survived;   // objects which survived at least one collection
+} alloc_site;
+
+// must be called before `__init`, NULL disables profiling
+void gc_set_alloc_profile (const char *path);
+// returns sites in the order of their first allocation
+const alloc_site *gc_alloc_profile_sites (size_t *number);
+// writes the report to `f`
+void gc_alloc_profile_dump (FILE *f);
+
+
+// ============================================================================
+//                              Heap census
+// ============================================================================
+// Census collects garbage and then counts live objects: by type, sexps by tag,
+// arrays by length (powers of two) and closures by entry. Entries are reported
+// as offsets from `gc_census_code_base`, which the interpreter sets to the start
+// of the bytecode. With YAILAMA_HEAP_CENSUS=<path> `__gc_init` arranges for the
+// census to be written to <path> as JSON at exit and whenever the process
+// receives GC_CENSUS_SIGNAL (the census is taken on the next allocation).
+#define GC_CENSUS_SIGNAL SIGUSR2
+// bucket 0 counts empty arrays, bucket i counts arrays of length in [2^(i-1), 2^i)
+#define CENSUS_ARRAY_LENGTH_BUCKETS 32
+
+extern size_t gc_census_code_base;
+
+typedef struct {
+  size_t key;   // sexp tag or closure entry offset
+  size_t objects;
+  size_t bytes;
+} census_entry;
+
+typedef struct {
+  census_entry *entries;
+  size_t        number;
+  size_t        capacity;
+  size_t       *index;   // open addressing hash table of entry numbers plus one, 0 marks empty buckets
+  size_t        index_capacity;
+} census_table;
+
+typedef struct {
+  size_t       objects[SEXP + 1];   // indexed by lama_type
+  size_t       bytes[SEXP + 1];
+  size_t       array_lengths[CENSUS_ARRAY_LENGTH_BUCKETS];
+  census_table sexp_tags;
+  census_table closure_entries;
+} heap_census;
+
+// collects garbage and counts live objects, the result is valid until the next census
+const heap_census *gc_take_heap_census (void);
+// takes census and writes it as JSON to `f`
+void gc_heap_census_dump (FILE *f);
+
+
+// ============================================================================
+//                            Stack watermark
+// ============================================================================
+// Deep recursion makes the Lama stack large while most of its frames stay
+// untouched between collections. The mutator may maintain two addresses:
+//  - __gc_stack_frame_limit: the current frame never writes at or above it
+//  - __gc_stack_watermark: words in [__gc_stack_watermark, __gc_stack_bottom)
+//    were not written since the last stack scan
+// Every stack scan remembers addresses of slots holding heap pointers and resets
+// the watermark to the frame limit. The next scan reuses remembered slots below
+// the watermark and reads only the part of the stack above it, update of
+// references after compaction touches remembered slots only. When a frame
+// returns, the mutator has to raise the watermark to the frame limit of the
+// caller. Zero (the default) means that nothing is known about the stack.
+extern size_t __gc_stack_watermark;
+extern size_t __gc_stack_frame_limit;
 
 
 // ============================================================================
@@ -163,12 +472,14 @@ void set_extra_roots (size_t extra_roots_size, void **extra_roots_ptr);
 // ============================================================================
 // accepts pointer to the start of the region and to the end of the region
 // scans it and if it meets a pointer, it should be modified in according to forward address
-void scan_and_fix_region (memory_chunk *old_heap, void *start, void *end);
+void scan_and_fix_region (void *start, void *end);
 
-// takes a pointer to an object content as an argument, returns forwarding address
+// takes a pointer to an object content as an argument, returns forwarding address (new address of the
+// object header), valid between `compute_locations` and the end of `physically_relocate`
 size_t get_forward_address (void *obj);
 
-// takes a pointer to an object content as an argument, sets forwarding address to value 'addr'
+// takes a pointer to an object content as an argument, sets forwarding address to value 'addr';
+// only traversal orders keep a forwarding table, sliding addresses are computed
 void set_forward_address (void *obj, size_t addr);
 
 // takes a pointer to an object content as an argument, returns whether this object was marked as live
@@ -180,15 +491,6 @@ void mark_object (void *obj);
 // takes a pointer to an object content as an argument, marks the object as dead
 void unmark_object (void *obj);
 
-// takes a pointer to an object content as an argument, returns whether this object was enqueued to the queue (which is used in mark phase)
-bool is_enqueued (void *obj);
-
-// takes a pointer to an object content as an argument, marks object as enqueued
-void make_enqueued (void *obj);
-
-// takes a pointer to an object content as an argument, unmarks object as enqueued
-void make_dequeued (void *obj);
-
 // returns iterator to an object with the lowest address
 heap_iterator heap_begin_iterator ();
 void          heap_next_obj_iterator (heap_iterator *it);
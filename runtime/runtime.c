@@ -7,6 +7,8 @@
 #include "gc.h"
 #include "runtime_common.h"
 
+#include <immintrin.h>
+
 extern size_t __gc_stack_top, __gc_stack_bottom;
 
 #define PRE_GC()
@@ -14,6 +16,7 @@ extern size_t __gc_stack_top, __gc_stack_bottom;
 #define POST_GC()
 
 static void vfailure (char *s, va_list args) {
+  flush_write_buffer();
   fprintf(stderr, "*** FAILURE: ");
   vfprintf(stderr, s, args);   // vprintf (char *, va_list) <-> printf (char *, ...)
   exit(255);
@@ -304,40 +307,117 @@ static void printStringBuf (char *fmt, ...) {
   vprintStringBuf(fmt, args);
 }
 
-static void printValue (void *p) {
+static const char digit_pairs[] = "00010203040506070809"
+                                  "10111213141516171819"
+                                  "20212223242526272829"
+                                  "30313233343536373839"
+                                  "40414243444546474849"
+                                  "50515253545556575859"
+                                  "60616263646566676869"
+                                  "70717273747576777879"
+                                  "80818283848586878889"
+                                  "90919293949596979899";
+
+// the same as sprintf(s, "%d", x) without the terminating zero, digits are produced two at a time
+// from the end; returns the number of characters written
+static size_t format_int (char *s, int x) {
+  char     digits[sizeof("-2147483648")];
+  char    *p = digits + sizeof(digits);
+  unsigned u = x < 0 ? 0u - (unsigned)x : (unsigned)x;
+  while (u >= 100) {
+    unsigned pair = u % 100 * 2;
+    u /= 100;
+    *--p = digit_pairs[pair + 1];
+    *--p = digit_pairs[pair];
+  }
+  if (u >= 10) {
+    *--p = digit_pairs[u * 2 + 1];
+    *--p = digit_pairs[u * 2];
+  } else {
+    *--p = '0' + u;
+  }
+  size_t len = 0;
+  if (x < 0) { s[len++] = '-'; }
+  size_t n = digits + sizeof(digits) - p;
+  memcpy(s + len, p, n);
+  return len + n;
+}
+
+// `string` renders a value in two passes over it: the first one only counts characters, so that the
+// result is allocated once with the exact size, the second one writes them right into it
+typedef struct {
+  char  *out;   // NULL while counting
+  size_t len;
+} render_buf;
+
+static void render_chars (render_buf *b, const char *s, size_t n) {
+  if (b->out != NULL) { memcpy(b->out + b->len, s, n); }
+  b->len += n;
+}
+
+static void render_str (render_buf *b, const char *s) { render_chars(b, s, strlen(s)); }
+
+static void render_int (render_buf *b, int x) {
+  if (b->out != NULL) {
+    b->len += format_int(b->out + b->len, x);
+    return;
+  }
+  unsigned u = x < 0 ? 0u - (unsigned)x : (unsigned)x;
+  b->len += x < 0 ? 2 : 1;
+  for (; u >= 10; u /= 10) { b->len++; }
+}
+
+// the same as "0x%x"
+static void render_hex (render_buf *b, size_t x) {
+  size_t digits = 1;
+  for (size_t rest = x >> 4; rest != 0; rest >>= 4) { digits++; }
+  if (b->out != NULL) {
+    char *p = b->out + b->len;
+    p[0]    = '0';
+    p[1]    = 'x';
+    for (char *q = p + 2 + digits; q > p + 2; x >>= 4) { *--q = "0123456789abcdef"[x & 0xF]; }
+  }
+  b->len += 2 + digits;
+}
+
+static void render_value (render_buf *b, void *p) {
   data *a = (data *)BOX(NULL);
   int   i = BOX(0);
   if (UNBOXED(p)) {
-    printStringBuf("%d", UNBOX(p));
+    render_int(b, UNBOX(p));
   } else {
-    if (!is_valid_heap_pointer(p)) {
-      printStringBuf("0x%x", p);
+    if (!is_runtime_object(p)) {
+      render_hex(b, (size_t)p);
       return;
     }
 
     a = TO_DATA(p);
 
     switch (TAG(a->data_header)) {
-      case STRING_TAG: printStringBuf("\"%s\"", a->contents); break;
+      case STRING_TAG:
+        render_str(b, "\"");
+        render_str(b, a->contents);
+        render_str(b, "\"");
+        break;
 
       case CLOSURE_TAG: {
 
-        printStringBuf("<closure ");
+        render_str(b, "<closure ");
         for (i = 0; i < LEN(a->data_header); i++) {
-          if (i) printValue((void *)((int *)a->contents)[i]);
-          else printStringBuf("0x%x", (void *)((int *)a->contents)[i]);
-          if (i != LEN(a->data_header) - 1) printStringBuf(", ");
+          if (i) render_value(b, (void *)((int *)a->contents)[i]);
+          else render_hex(b, ((size_t *)a->contents)[i]);
+          if (i != LEN(a->data_header) - 1) render_str(b, ", ");
         }
-        printStringBuf(">");
+        render_str(b, ">");
         break;
       }
       case ARRAY_TAG: {
-        printStringBuf("[");
+        render_str(b, "[");
         for (i = 0; i < LEN(a->data_header); i++) {
-          printValue((void *)((int *)a->contents)[i]);
-          if (i != LEN(a->data_header) - 1) printStringBuf(", ");
+          render_value(b, (void *)((int *)a->contents)[i]);
+          if (i != LEN(a->data_header) - 1) render_str(b, ", ");
         }
-        printStringBuf("]");
+        render_str(b, "]");
         break;
       }
 
@@ -346,31 +426,34 @@ static void printValue (void *p) {
         char *tag = de_hash(sa->tag);
         if (strcmp(tag, "cons") == 0) {
           sexp *sb = sa;
-          printStringBuf("{");
+          render_str(b, "{");
           while (LEN(sb->data_header)) {
-            printValue((void *)((int *)sb->contents)[0]);
+            render_value(b, (void *)((int *)sb->contents)[0]);
             int list_next = ((int *)sb->contents)[1];
             if (!UNBOXED(list_next)) {
-              printStringBuf(", ");
+              render_str(b, ", ");
               sb = TO_SEXP(list_next);
             } else break;
           }
-          printStringBuf("}");
+          render_str(b, "}");
         } else {
-          printStringBuf("%s", tag);
+          render_str(b, tag);
           sexp *sexp_a = (sexp *)a;
           if (LEN(a->data_header)) {
-            printStringBuf(" (");
+            render_str(b, " (");
             for (i = 0; i < LEN(sexp_a->data_header); i++) {
-              printValue((void *)((int *)sexp_a->contents)[i]);
-              if (i != LEN(sexp_a->data_header) - 1) printStringBuf(", ");
+              render_value(b, (void *)((int *)sexp_a->contents)[i]);
+              if (i != LEN(sexp_a->data_header) - 1) render_str(b, ", ");
             }
-            printStringBuf(")");
+            render_str(b, ")");
           }
         }
       } break;
 
-      default: printStringBuf("*** invalid data_header: 0x%x ***", TAG(a->data_header));
+      default:
+        render_str(b, "*** invalid data_header: ");
+        render_hex(b, TAG(a->data_header));
+        render_str(b, " ***");
     }
   }
 }
@@ -545,7 +628,7 @@ int inner_hash (int depth, unsigned acc, void *p) {
   if (depth > HASH_DEPTH) return acc;
 
   if (UNBOXED(p)) return HASH_APPEND(acc, UNBOX(p));
-  else if (is_valid_heap_pointer(p)) {
+  else if (is_runtime_object(p)) {
     data *a = TO_DATA(p);
     int   t = TAG(a->data_header), l = LEN(a->data_header), i;
 
@@ -606,7 +689,105 @@ extern int LflatCompare (void *p, void *q) {
   } else BOX(1);
 }
 
-extern int Lcompare (void *p, void *q) {
+/* Structural comparison */
+
+// Equal words compare equal whatever they hold, so runs of them are skipped by comparing blocks of
+// fields at once; strings are compared in blocks up to the first difference or the end of either
+// one. The widest instruction set the CPU supports is chosen on the first comparison
+
+// index of the first word that differs in `a` and `b` among the first `n`, or `n`
+static size_t words_mismatch_scalar (const size_t *a, const size_t *b, size_t n) {
+  size_t i = 0;
+  while (i < n && a[i] == b[i]) { i++; }
+  return i;
+}
+
+__attribute__((target("sse2"))) static size_t words_mismatch_sse2 (const size_t *a, const size_t *b,
+                                                                  size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i  x    = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i  y    = _mm_loadu_si128((const __m128i *)(b + i));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi32(x, y));
+    if (mask != 0xFFFF) { return i + __builtin_ctz(~mask) / sizeof(size_t); }
+  }
+  return i + words_mismatch_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2"))) static size_t words_mismatch_avx2 (const size_t *a, const size_t *b,
+                                                                  size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i  x    = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i  y    = _mm256_loadu_si256((const __m256i *)(b + i));
+    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi32(x, y));
+    if (mask != 0xFFFFFFFF) { return i + __builtin_ctz(~mask) / sizeof(size_t); }
+  }
+  return i + words_mismatch_sse2(a + i, b + i, n - i);
+}
+
+// index of the first character among the first `n` which differs in `a` and `b` or ends them, or n
+static size_t chars_mismatch_scalar (const char *a, const char *b, size_t n) {
+  size_t i = 0;
+  while (i < n && a[i] == b[i] && a[i] != 0) { i++; }
+  return i;
+}
+
+__attribute__((target("sse2"))) static size_t chars_mismatch_sse2 (const char *a, const char *b,
+                                                                  size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i  x    = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i  y    = _mm_loadu_si128((const __m128i *)(b + i));
+    __m128i  stop = _mm_cmpeq_epi8(x, _mm_setzero_si128());
+    unsigned mask = _mm_movemask_epi8(_mm_andnot_si128(stop, _mm_cmpeq_epi8(x, y)));
+    if (mask != 0xFFFF) { return i + __builtin_ctz(~mask); }
+  }
+  return i + chars_mismatch_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2"))) static size_t chars_mismatch_avx2 (const char *a, const char *b,
+                                                                  size_t n) {
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i  x    = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i  y    = _mm256_loadu_si256((const __m256i *)(b + i));
+    __m256i  stop = _mm256_cmpeq_epi8(x, _mm256_setzero_si256());
+    unsigned mask = _mm256_movemask_epi8(_mm256_andnot_si256(stop, _mm256_cmpeq_epi8(x, y)));
+    if (mask != 0xFFFFFFFF) { return i + __builtin_ctz(~mask); }
+  }
+  return i + chars_mismatch_sse2(a + i, b + i, n - i);
+}
+
+static size_t (*words_mismatch) (const size_t *, const size_t *, size_t) = NULL;
+static size_t (*chars_mismatch) (const char *, const char *, size_t)     = NULL;
+
+static void compare_setup (void) {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    words_mismatch = words_mismatch_avx2;
+    chars_mismatch = chars_mismatch_avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    words_mismatch = words_mismatch_sse2;
+    chars_mismatch = chars_mismatch_sse2;
+  } else {
+    words_mismatch = words_mismatch_scalar;
+    chars_mismatch = chars_mismatch_scalar;
+  }
+}
+
+// fields of two objects which are still to be compared
+typedef struct {
+  void **a, **b;
+  size_t n;
+} compare_frame;
+
+// returned by `compare_shallow` instead of a result, which is always boxed
+#define COMPARE_FIELDS 0
+#define COMPARE_INLINE_FRAMES 64
+
+// compares everything but fields, which are left in `fields`
+static int compare_shallow (void *p, void *q, compare_frame *fields) {
 #define COMPARE_AND_RETURN(x, y)                                                                   \
   do                                                                                               \
     if (x != y) return BOX(x - y);                                                                 \
@@ -619,51 +800,96 @@ extern int Lcompare (void *p, void *q) {
     else return BOX(-1);
   } else if (UNBOXED(q)) return BOX(1);
   else {
-    if (is_valid_heap_pointer(p)) {
-      if (is_valid_heap_pointer(q)) {
+    if (is_runtime_object(p)) {
+      if (is_runtime_object(q)) {
         data *a = TO_DATA(p), *b = TO_DATA(q);
         int   ta = TAG(a->data_header), tb = TAG(b->data_header);
         int   la = LEN(a->data_header), lb = LEN(b->data_header);
-        int   i;
-        int   shift = 0;
 
         COMPARE_AND_RETURN(ta, tb);
 
         switch (ta) {
-          case STRING_TAG: return BOX(strcmp(a->contents, b->contents));
+          case STRING_TAG: {
+            // the common prefix is skipped, strcmp decides on the rest as it would on whole
+            // strings; short strings aren't worth an indirect call
+            size_t i = MIN(la, lb) < 32 ? 0 : chars_mismatch(a->contents, b->contents, MIN(la, lb));
+            return BOX(strcmp(a->contents + i, b->contents + i));
+          }
 
           case CLOSURE_TAG:
             COMPARE_AND_RETURN(((void **)a->contents)[0], ((void **)b->contents)[0]);
             COMPARE_AND_RETURN(la, lb);
-            i = 1;
+            *fields = (compare_frame) {
+                (void **)a->contents + 1, (void **)b->contents + 1, MAX(la, 1) - 1};
             break;
 
           case ARRAY_TAG:
             COMPARE_AND_RETURN(la, lb);
-            i = 0;
+            *fields = (compare_frame) {(void **)a->contents, (void **)b->contents, la};
             break;
 
           case SEXP_TAG: {
             int tag_a = TO_SEXP(p)->tag, tag_b = TO_SEXP(q)->tag;
             COMPARE_AND_RETURN(tag_a, tag_b);
             COMPARE_AND_RETURN(la, lb);
-            i     = 0;
-            shift = 1;
+            *fields = (compare_frame) {(void **)a->contents + 1, (void **)b->contents + 1, la};
             break;
           }
 
           default: failure("invalid data_header %d in compare *****\n", ta);
         }
-
-        for (; i < la; i++) {
-          int c = Lcompare(((void **)a->contents)[i + shift], ((void **)b->contents)[i + shift]);
-          if (c != BOX(0)) return c;
-        }
-        return BOX(0);
+        return COMPARE_FIELDS;
       } else return BOX(-1);
-    } else if (is_valid_heap_pointer(q)) return BOX(1);
+    } else if (is_runtime_object(q)) return BOX(1);
     else return BOX(p - q);
   }
+#undef COMPARE_AND_RETURN
+}
+
+// fields are compared depth-first with an explicit stack, so deep structures don't exhaust the C
+// stack; the last field of an object takes the place of its frame, so lists need a single one
+extern int Lcompare (void *p, void *q) {
+  compare_frame  inline_frames[COMPARE_INLINE_FRAMES];
+  compare_frame *frames   = inline_frames;
+  size_t         capacity = COMPARE_INLINE_FRAMES, depth = 0;
+  int            result   = BOX(0);
+
+  if (words_mismatch == NULL) { compare_setup(); }
+  result = compare_shallow(p, q, &frames[0]);
+  if (result != COMPARE_FIELDS) { return result; }
+  result = BOX(0);
+  depth  = 1;
+  while (depth > 0) {
+    compare_frame *f = &frames[depth - 1];
+    size_t         i = words_mismatch((size_t *)f->a, (size_t *)f->b, f->n);
+    if (i == f->n) {
+      depth--;
+      continue;
+    }
+    void *x = f->a[i], *y = f->b[i];
+    f->a += i + 1;
+    f->b += i + 1;
+    f->n -= i + 1;
+    if (f->n == 0) { depth--; }
+    if (depth == capacity) {
+      capacity *= 2;
+      compare_frame *grown = frames == inline_frames
+                                 ? malloc(capacity * sizeof(compare_frame))
+                                 : realloc(frames, capacity * sizeof(compare_frame));
+      if (grown == NULL) { failure("compare: out of memory\n"); }
+      if (frames == inline_frames) { memcpy(grown, inline_frames, sizeof(inline_frames)); }
+      frames = grown;
+    }
+    result = compare_shallow(x, y, &frames[depth]);
+    if (result == COMPARE_FIELDS) {
+      result = BOX(0);
+      depth++;
+    } else if (result != BOX(0)) {
+      break;
+    }
+  }
+  if (frames != inline_frames) { free(frames); }
+  return result;
 }
 
 extern void *Belem (void *p, int i) {
@@ -754,18 +980,21 @@ extern void *Lstringcat (void *p) {
 }
 
 extern void *Lstring (void *p) {
-  void *s = (void *)BOX(NULL);
+  void      *s = (void *)BOX(NULL);
+  render_buf b = {NULL, 0};
 
-  PRE_GC();
+  render_value(&b, p);
 
-  createStringBuf();
-  printValue(p);
+  PRE_GC();
 
   push_extra_root(&p);
-  s = Bstring(stringBuf.contents);
+  s = LmakeString(BOX(b.len));
   pop_extra_root(&p);
 
-  deleteStringBuf();
+  // the collection may have moved the value, but not changed how it looks
+  b = (render_buf) {s, 0};
+  render_value(&b, p);
+  b.out[b.len] = 0;
 
   POST_GC();
 
@@ -943,14 +1172,18 @@ extern void *Bsta (void *v, int i, void *x) {
         break;
       }
       case SEXP_TAG: {
+        gc_write_barrier(((void **)x)[UNBOX(i) + 1]);
         ((int *)x)[UNBOX(i) + 1] = (int)v;
         break;
       }
       default: {
+        gc_write_barrier(((void **)x)[UNBOX(i)]);
         ((int *)x)[UNBOX(i)] = (int)v;
       }
     }
   } else {
+    // x may also be a reference to a variable outside the heap, recording its old value is harmless
+    gc_write_barrier(*(void **)x);
     *(void **)x = v;
   }
 
@@ -986,6 +1219,7 @@ extern void LprintfPerror (char *s, ...) {
 
   va_start(args, s);
   fix_unboxed(s, args);
+  flush_write_buffer();
 
   if (vfprintf(stderr, s, args) < 0) { failure("printfPerror (...): %s\n", strerror(errno)); }
 
@@ -993,13 +1227,16 @@ extern void LprintfPerror (char *s, ...) {
 }
 
 extern void Bmatch_failure (void *v, char *fname, int line, int col) {
-  createStringBuf();
-  printValue(v);
-  failure("match failure at %s:%d:%d, value '%s'\n",
-          fname,
-          UNBOX(line),
-          UNBOX(col),
-          stringBuf.contents);
+  render_buf b = {NULL, 0};
+  render_value(&b, v);
+  b = (render_buf) {malloc(b.len + 1), 0};
+  if (b.out == NULL) {
+    failure("match failure at %s:%d:%d, out of memory to render the value\n", fname, UNBOX(line),
+            UNBOX(col));
+  }
+  render_value(&b, v);
+  b.out[b.len] = 0;
+  failure("match failure at %s:%d:%d, value '%s'\n", fname, UNBOX(line), UNBOX(col), b.out);
 }
 
 extern void * /*Lstrcat*/ Li__Infix_4343 (void *a, void *b) {
@@ -1084,6 +1321,7 @@ extern void Lfprintf (FILE *f, char *s, ...) {
 
   va_start(args, s);
   fix_unboxed(s, args);
+  flush_write_buffer();
 
   if (vfprintf(f, s, args) < 0) { failure("fprintf (...): %s\n", strerror(errno)); }
 }
@@ -1095,6 +1333,7 @@ extern void Lprintf (char *s, ...) {
 
   va_start(args, s);
   fix_unboxed(s, args);
+  flush_write_buffer();
 
   if (vprintf(s, args) < 0) { failure("fprintf (...): %s\n", strerror(errno)); }
 
@@ -1194,31 +1433,111 @@ extern void *Lhd (void *v) { return Belem(v, BOX(0)); }
 
 extern void *Ltl (void *v) { return Belem(v, BOX(1)); }
 
-/* Lread is an implementation of the "read" construct */
-extern int Lread () {
-  int result = BOX(0);
-
-  printf("> ");
-  fflush(stdout);
-  scanf("%d", &result);
-
-  return BOX(result);
-}
-
 extern int Lbinoperror (void) {
+  flush_write_buffer();
   fprintf(stderr, "ERROR: POINTER ARITHMETICS is forbidden; EXIT\n");
   exit(1);
 }
 
 extern int Lbinoperror2 (void) {
+  flush_write_buffer();
   fprintf(stderr, "ERROR: Comparing BOXED and UNBOXED value ; EXIT\n");
   exit(1);
 }
 
+/* Buffered input and output of the "read" and "write" constructs */
+
+// unless stdout is a terminal, `write` formats integers into this buffer, which goes to stdout when
+// it is full, before anything else is printed by the runtime, and at exit
+#define WRITE_BUFFER_SIZE (1 << 16)
+// "-2147483648\n"
+#define WRITE_MAX_CHARS 12
+
+static struct {
+  char   data[WRITE_BUFFER_SIZE];
+  size_t used;
+  int    enabled;   // -1 until the first `write` decides
+} write_buffer = {.enabled = -1};
+
+void flush_write_buffer (void) {
+  if (write_buffer.used == 0) { return; }
+  fwrite(write_buffer.data, 1, write_buffer.used, stdout);
+  fflush(stdout);
+  write_buffer.used = 0;
+}
+
+// YAILAMA_BUFFERED_WRITE=0 or 1 overrides the check for a terminal
+static void write_buffer_setup (void) {
+  const char *value    = getenv("YAILAMA_BUFFERED_WRITE");
+  write_buffer.enabled = value != NULL ? strcmp(value, "0") != 0 : !isatty(STDOUT_FILENO);
+  if (write_buffer.enabled) { atexit(flush_write_buffer); }
+}
+
+// the same as sprintf(s, "%d\n", x), returns the number of characters written
+static size_t format_int_line (char *s, int x) {
+  size_t len = format_int(s, x);
+  s[len]     = '\n';
+  return len + 1;
+}
+
+// the same as scanf("%d", x) on stdin without interpreting a format: skips white space, takes an
+// optional sign and the longest run of digits, saturating on overflow as strtol does. A sign is
+// consumed even if no digits follow it, the first character after the number is left unread.
+// Characters come from the stdio buffer, so other readers of stdin stay in sync; returns false and
+// leaves `x` intact on end of input or malformed input
+static bool read_int (int *x) {
+  int c;
+  do { c = getc_unlocked(stdin); } while (isspace(c));
+  bool negative = c == '-';
+  if (c == '-' || c == '+') { c = getc_unlocked(stdin); }
+  if (!isdigit(c)) {
+    if (c != EOF) { ungetc(c, stdin); }
+    return false;
+  }
+  unsigned long long value = 0;
+  for (; isdigit(c); c = getc_unlocked(stdin)) {
+    if (value <= (unsigned long long)INT_MAX + 1) { value = value * 10 + (c - '0'); }
+  }
+  if (c != EOF) { ungetc(c, stdin); }
+  if (negative) {
+    *x = value > (unsigned long long)INT_MAX + 1 ? INT_MIN : (int)-(long long)value;
+  } else {
+    *x = value > INT_MAX ? INT_MAX : (int)value;
+  }
+  return true;
+}
+
+/* Lread is an implementation of the "read" construct */
+extern int Lread () {
+  int result = BOX(0);
+
+  if (write_buffer.enabled < 0) { write_buffer_setup(); }
+  if (write_buffer.enabled) {
+    // stdout may still be a terminal (YAILAMA_BUFFERED_WRITE=1), so the prompt and the output
+    // before it are written out before blocking on stdin
+    if (write_buffer.used + 2 > WRITE_BUFFER_SIZE) { flush_write_buffer(); }
+    memcpy(write_buffer.data + write_buffer.used, "> ", 2);
+    write_buffer.used += 2;
+    flush_write_buffer();
+  } else {
+    printf("> ");
+    fflush(stdout);
+  }
+  read_int(&result);
+
+  return BOX(result);
+}
+
 /* Lwrite is an implementation of the "write" construct */
 extern int Lwrite (int n) {
-  printf("%d\n", UNBOX(n));
-  fflush(stdout);
+  if (write_buffer.enabled < 0) { write_buffer_setup(); }
+  if (!write_buffer.enabled) {
+    printf("%d\n", UNBOX(n));
+    fflush(stdout);
+    return 0;
+  }
+  if (write_buffer.used + WRITE_MAX_CHARS > WRITE_BUFFER_SIZE) { flush_write_buffer(); }
+  write_buffer.used += format_int_line(write_buffer.data + write_buffer.used, UNBOX(n));
 
   return 0;
 }
@@ -12,9 +12,12 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <time.h>
+#include <unistd.h>
 
 #define WORD_SIZE (CHAR_BIT * sizeof(int))
 
 void failure (char *s, ...);
+// writes out integers buffered by `Lwrite`, must precede any other output to stdout or stderr
+void flush_write_buffer (void);
 
 #endif
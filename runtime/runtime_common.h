@@ -18,9 +18,9 @@
 #define SEXP_ONLY_HEADER_SZ (sizeof(int))
 
 #ifndef DEBUG_VERSION
-#  define DATA_HEADER_SZ (sizeof(size_t) + sizeof(int))
+#  define DATA_HEADER_SZ (sizeof(int))
 #else
-#  define DATA_HEADER_SZ (sizeof(size_t) + sizeof(size_t) + sizeof(int))
+#  define DATA_HEADER_SZ (sizeof(size_t) + sizeof(int))
 #endif
 
 #define MEMBER_SIZE sizeof(int)
@@ -48,10 +48,8 @@ typedef struct {
   size_t id;
 #endif
 
-  // last bit is used as MARK-BIT, the rest are used to store address where object should move
-  // last bit can be used because due to alignment we can assume that last two bits are always 0's
-  size_t forward_address;
-  char   contents[0];
+  // GC metadata (mark bits, forwarding addresses) is kept in side tables, see gc.h
+  char contents[0];
 } data;
 
 typedef struct {
@@ -63,11 +61,10 @@ typedef struct {
   size_t id;
 #endif
 
-  // last bit is used as MARK-BIT, the rest are used to store address where object should move
-  // last bit can be used because due to alignment we can assume that last two bits are always 0's
-  size_t forward_address;
-  int    tag;
-  int    contents[0];
+  // hash of the constructor name takes 30 bits, so it doesn't fit into `data_header` next to the
+  // number of fields and occupies a word of its own
+  int tag;
+  int contents[0];
 } sexp;
 
 #endif
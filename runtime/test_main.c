@@ -42,6 +42,10 @@ extern size_t call_runtime_function (void *virt_stack_pointer, void *function_po
 
 #  include "virt_stack.h"
 
+// runtime functions may trigger GC, so arguments pushed onto virtual stack have to be visible as roots
+#  define call_runtime_function(sp, f, n, ...)                                                    \
+    (__gc_stack_top = (size_t)(sp)-4 * (n)-4, call_runtime_function(sp, f, n, __VA_ARGS__))
+
 virt_stack *init_test () {
   __init();
   virt_stack *st = vstack_create();
@@ -120,6 +124,112 @@ void test_simple_closure_alloc (void) {
   cleanup_test(st);
 }
 
+extern void *Lstring (void *p);
+
+void test_string_rendering (void) {
+  virt_stack *st = init_test();
+
+  vstack_push(st, call_runtime_function(vstack_top(st) - 4, Bstring, 1, "ab"));
+  vstack_push(st,
+              call_runtime_function(
+                  vstack_top(st) - 4, Bsexp, 4, BOX(3), BOX(8), BOX(0), LtagHash("cons")));
+  vstack_push(st,
+              call_runtime_function(vstack_top(st) - 4,
+                                    Bsexp,
+                                    4,
+                                    BOX(3),
+                                    BOX(7),
+                                    vstack_kth_from_start(st, 1),
+                                    LtagHash("cons")));
+  vstack_push(st,
+              call_runtime_function(
+                  vstack_top(st) - 4, Bsexp, 4, BOX(3), BOX(3), BOX(1000000), LtagHash("Box")));
+  size_t arr = call_runtime_function(vstack_top(st) - 4,
+                                     Barray,
+                                     6,
+                                     BOX(5),
+                                     BOX(1),
+                                     BOX(-(1 << 30)),
+                                     vstack_kth_from_start(st, 0),
+                                     vstack_kth_from_start(st, 2),
+                                     vstack_kth_from_start(st, 3));
+  vstack_push(st, arr);
+  force_gc_cycle(st);
+
+  char *s =
+      (char *)call_runtime_function(vstack_top(st) - 4, Lstring, 1, vstack_kth_from_start(st, 4));
+  assert((strcmp(s, "[1, -1073741824, \"ab\", {7, 8}, Box (3, 1000000)]") == 0));
+  assert((LEN(TO_DATA(s)->data_header) == strlen(s)));
+
+  cleanup_test(st);
+}
+
+extern int   Lcompare (void *p, void *q);
+extern void *LmakeArray (int length);
+
+// builds a list of 0, 1, ..., n - 1 ending with `last` on top of the stack
+static void push_compare_list (virt_stack *st, int n, int last) {
+  vstack_push(st, BOX(0));
+  for (int i = n - 1; i >= 0; --i) {
+    size_t cell = call_runtime_function(vstack_top(st) - 4,
+                                        Bsexp,
+                                        4,
+                                        BOX(3),
+                                        BOX(i == n - 1 ? last : i),
+                                        vstack_kth_from_start(st, vstack_size(st) - 1),
+                                        LtagHash("cons"));
+    vstack_pop(st);
+    vstack_push(st, cell);
+  }
+}
+
+void test_structural_compare (void) {
+  virt_stack *st = init_test();
+
+  // a list this long used to exhaust the C stack
+  const int N = 100000;
+  push_compare_list(st, N, N - 1);
+  push_compare_list(st, N, N - 1);
+  push_compare_list(st, N, N + 4);
+  void *l0 = (void *)vstack_kth_from_start(st, 0), *l1 = (void *)vstack_kth_from_start(st, 1),
+       *l2 = (void *)vstack_kth_from_start(st, 2);
+  assert((Lcompare(l0, l1) == BOX(0)));
+  assert((Lcompare(l0, l2) == BOX(-5)));
+  assert((Lcompare(l2, l0) == BOX(5)));
+
+  // long runs of equal integers and the first difference at every position of a SIMD block
+  const int M = 40;
+  for (int k = 0; k < M; ++k) {
+    vstack_push(st, call_runtime_function(vstack_top(st) - 4, LmakeArray, 1, BOX(M)));
+    size_t b      = call_runtime_function(vstack_top(st) - 4, LmakeArray, 1, BOX(M));
+    size_t a      = vstack_pop(st);
+    ((int *)b)[k] = BOX(7);
+    assert((Lcompare((void *)a, (void *)b) == BOX(-7)));
+    assert((Lcompare((void *)b, (void *)a) == BOX(7)));
+  }
+
+  // strings decide by the first difference or the end of the shorter one
+  char x[80], y[80];
+  for (int k = 0; k < 70; ++k) {
+    memset(x, 'a', sizeof(x) - 1);
+    memset(y, 'a', sizeof(y) - 1);
+    x[sizeof(x) - 1] = y[sizeof(y) - 1] = 0;
+    y[k]                                = 'c';
+    x[k + 5]                            = 0;
+    vstack_push(st, call_runtime_function(vstack_top(st) - 4, Bstring, 1, x));
+    void *sy = (void *)call_runtime_function(vstack_top(st) - 4, Bstring, 1, y);
+    void *sx = (void *)vstack_kth_from_start(st, vstack_size(st) - 1);
+    assert((UNBOX(Lcompare(sx, sy)) < 0 && UNBOX(Lcompare(sy, sx)) > 0));
+    y[k]     = 'a';
+    y[k + 5] = 0;
+    sy       = (void *)call_runtime_function(vstack_top(st) - 4, Bstring, 1, y);
+    sx       = (void *)vstack_pop(st);
+    assert((Lcompare(sx, sy) == BOX(0)));
+  }
+
+  cleanup_test(st);
+}
+
 void test_single_object_allocation_with_collection_virtual_stack (void) {
   virt_stack *st = init_test();
 
@@ -193,6 +303,294 @@ void test_small_tree_compaction (void) {
   cleanup_test(st);
 }
 
+void test_gc_stats (void) {
+  virt_stack     *st     = init_test();
+  const gc_stats *stats  = gc_get_stats();
+  size_t          before = stats->collections;
+  size_t          bytes  = stats->allocated_bytes;
+
+  vstack_push(st, call_runtime_function(vstack_top(st) - 4, Bstring, 1, "alive"));
+  call_runtime_function(vstack_top(st) - 4, Bstring, 1, "garbage");
+  force_gc_cycle(st);
+
+  assert((stats->collections > before));
+  assert((stats->allocated_bytes == bytes + string_size(5) + string_size(7)));
+  assert((stats->cycles[stats->collections - 1].live_words == BYTES_TO_WORDS(string_size(5))));
+  size_t histogram_total = 0;
+  for (int i = 0; i < GC_PAUSE_HISTOGRAM_BUCKETS; ++i) { histogram_total += stats->pause_histogram[i]; }
+  assert((histogram_total >= stats->collections));
+
+  cleanup_test(st);
+}
+
+void test_heap_shrinks_after_peak (void) {
+  virt_stack     *st    = init_test();
+  const gc_stats *stats = gc_get_stats();
+
+  // enough live data for the heap to span many pages
+  const int N = 4096;
+  for (int i = 0; i < N; ++i) {
+    vstack_push(st, call_runtime_function(vstack_top(st) - 4, Bstring, 1, "peak"));
+  }
+  force_gc_cycle(st);
+  size_t peak     = stats->cycles[stats->collections - 1].heap_words;
+  size_t released = stats->released_bytes;
+  for (int i = 0; i < N - 1; ++i) { vstack_pop(st); }
+
+  // a single collection with little live data doesn't shrink the heap
+  force_gc_cycle(st);
+  assert((stats->cycles[stats->collections - 1].heap_words == peak));
+  for (int i = 1; i < HEAP_SHRINK_CYCLES; ++i) { force_gc_cycle(st); }
+  assert((stats->cycles[stats->collections - 1].heap_words < peak));
+  assert((stats->released_bytes > released));
+
+  cleanup_test(st);
+}
+
+void test_alloc_profile (void) {
+  gc_set_alloc_profile("alloc-profile");
+  virt_stack *st = init_test();
+
+  gc_alloc_site = 0x10;
+  vstack_push(st, call_runtime_function(vstack_top(st) - 4, Bstring, 1, "alive"));
+  call_runtime_function(vstack_top(st) - 4, Bstring, 1, "dead");
+  gc_alloc_site = 0x20;
+  call_runtime_function(vstack_top(st) - 4, Bsexp, 2, BOX(1), LtagHash("Nil"));
+  force_gc_cycle(st);
+
+  size_t            number;
+  const alloc_site *sites = gc_alloc_profile_sites(&number);
+  assert((number == 2));
+  assert((sites[0].offset == 0x10 && sites[0].type == STRING));
+  assert((sites[0].objects == 2 && sites[0].survived == 1));
+  assert((sites[0].bytes == string_size(5) + string_size(4)));
+  assert((sites[1].offset == 0x20 && sites[1].type == SEXP));
+  assert((sites[1].tag == UNBOX(LtagHash("Nil")) && sites[1].survived == 0));
+
+  cleanup_test(st);
+  gc_set_alloc_profile(NULL);
+}
+
+void test_heap_census (void) {
+  virt_stack *st = init_test();
+
+  vstack_push(st, call_runtime_function(vstack_top(st) - 4, Bstring, 1, "census"));
+  call_runtime_function(vstack_top(st) - 4, Bstring, 1, "dead");
+  vstack_push(st, call_runtime_function(vstack_top(st) - 4, Bsexp, 2, BOX(1), LtagHash("Cons")));
+  vstack_push(st,
+              call_runtime_function(
+                  vstack_top(st) - 4, Barray, 3, BOX(2), BOX(1), vstack_kth_from_start(st, 0)));
+
+  __gc_stack_top       = (size_t)vstack_top(st) - 4;
+  const heap_census *c = gc_take_heap_census();
+  assert((c->objects[STRING] == 1 && c->bytes[STRING] == string_size(6)));
+  assert((c->objects[SEXP] == 1 && c->objects[ARRAY] == 1 && c->objects[CLOSURE] == 0));
+  assert((c->array_lengths[2] == 1));
+  assert((c->sexp_tags.number == 1));
+  assert((c->sexp_tags.entries[0].key == UNBOX(LtagHash("Cons"))));
+  assert((c->sexp_tags.entries[0].objects == 1));
+
+  cleanup_test(st);
+}
+
+// a census collects the heap, the object allocated last must be attributed to its site before it moves
+void test_heap_census_with_alloc_profile (void) {
+  gc_set_alloc_profile("alloc-profile");
+  virt_stack *st = init_test();
+
+  gc_alloc_site = 0x20;
+  call_runtime_function(vstack_top(st) - 4, Bsexp, 2, BOX(1), LtagHash("Dead"));
+  gc_alloc_site = 0x10;
+  vstack_push(st, call_runtime_function(vstack_top(st) - 4, Bsexp, 2, BOX(1), LtagHash("Alive")));
+
+  __gc_stack_top       = (size_t)vstack_top(st) - 4;
+  const heap_census *c = gc_take_heap_census();
+  assert((c->objects[SEXP] == 1));
+  assert((c->sexp_tags.entries[0].key == UNBOX(LtagHash("Alive"))));
+
+  size_t            number;
+  const alloc_site *sites = gc_alloc_profile_sites(&number);
+  assert((number == 2));
+  assert((sites[0].offset == 0x20 && sites[0].objects == 1 && sites[0].survived == 0));
+  assert((sites[1].offset == 0x10 && sites[1].objects == 1 && sites[1].survived == 1));
+  assert((sites[1].tag == UNBOX(LtagHash("Alive"))));
+
+  cleanup_test(st);
+  gc_set_alloc_profile(NULL);
+}
+
+extern memory_chunk heap;
+extern void        *Belem (void *p, int i);
+
+void test_strings_in_pointer_free_space (void) {
+  virt_stack *st = init_test();
+
+  call_runtime_function(vstack_top(st) - 4, Bstring, 1, "dead");
+  vstack_push(st, call_runtime_function(vstack_top(st) - 4, Bstring, 1, "kept"));
+  vstack_push(st,
+              call_runtime_function(
+                  vstack_top(st) - 4, Bsexp, 3, BOX(2), vstack_kth_from_start(st, 0), LtagHash("Box")));
+  force_gc_cycle(st);
+
+  size_t str = vstack_kth_from_start(st, 0);
+  assert((str < (size_t)heap.begin || str > (size_t)heap.current));
+  assert((strcmp((char *)str, "kept") == 0));
+  assert(((size_t)Belem((void *)vstack_kth_from_start(st, 1), BOX(0)) == str));
+
+  cleanup_test(st);
+}
+
+void test_hierarchical_compaction_order (void) {
+  gc_set_compaction_order(GC_ORDER_HIERARCHICAL);
+  virt_stack *st = init_test();
+
+  // cells are allocated from the tail, garbage is interleaved with them
+  const int N = 8;
+  vstack_push(st, BOX(0));
+  for (int i = 0; i < N; ++i) {
+    size_t cell = call_runtime_function(
+        vstack_top(st) - 4, Bsexp, 4, BOX(3), BOX(i), vstack_kth_from_start(st, 0), LtagHash("Cons"));
+    vstack_pop(st);
+    vstack_push(st, cell);
+    call_runtime_function(vstack_top(st) - 4, Barray, 2, BOX(1), BOX(i));
+  }
+  force_gc_cycle(st);
+
+  // after the collection the spine goes forward through adjacent cells
+  size_t cell = vstack_kth_from_start(st, 0);
+  for (int i = 0; i < N - 1; ++i) {
+    size_t next = (size_t)Belem((void *)cell, BOX(1));
+    assert((next == cell + WORDS_TO_BYTES(BYTES_TO_WORDS(sexp_size(2)))));
+    cell = next;
+  }
+
+  cleanup_test(st);
+  gc_set_compaction_order(GC_ORDER_ADDRESS);
+}
+
+extern void *Bsta (void *v, int i, void *x);
+
+void test_incremental_marking_write_barrier (void) {
+  virt_stack *st = init_test();
+  gc_set_incremental_marking(1);
+
+  vstack_push(st, call_runtime_function(vstack_top(st) - 4, Bstring, 1, "hidden"));
+  size_t arr =
+      call_runtime_function(vstack_top(st) - 4, Barray, 2, BOX(1), vstack_kth_from_start(st, 0));
+  vstack_pop(st);
+  vstack_push(st, arr);
+  force_gc_cycle(st);
+
+  // at the snapshot the string is reachable through the array only
+  __gc_stack_top = (size_t)vstack_top(st) - 4;
+  gc_start_incremental_marking();
+  arr = vstack_kth_from_start(st, 0);
+  vstack_push(st, ((size_t *)arr)[0]);
+  call_runtime_function(vstack_top(st) - 4, Bsta, 3, BOX(0), BOX(0), arr);
+  force_gc_cycle(st);
+
+  assert((!gc_marking_in_progress));
+  const int N = 10;
+  int       ids[N];
+  size_t    alive = objects_snapshot(ids, N);
+  assert((alive == 2));
+  assert((strcmp((char *)vstack_kth_from_start(st, 1), "hidden") == 0));
+
+  gc_set_incremental_marking(0);
+  cleanup_test(st);
+}
+
+void test_large_object_is_not_moved (void) {
+  virt_stack *st = init_test();
+
+  call_runtime_function(vstack_top(st) - 4, Bstring, 1, "garbage");
+  const int N = LARGE_OBJECT_WORDS;
+  vstack_push(st, call_runtime_function(vstack_top(st) - 4, LmakeArray, 1, BOX(N)));
+  size_t arr = vstack_kth_from_start(st, 0);
+  assert((is_large_object((void *)arr)));
+  for (int i = 0; i < N; i += N / 4) {
+    size_t str = call_runtime_function(vstack_top(st) - 4, Bstring, 1, "element");
+    call_runtime_function(vstack_top(st) - 4, Bsta, 3, str, BOX(i), arr);
+  }
+  force_gc_cycle(st);
+
+  // the array stays in place while the strings it references are slid
+  assert((vstack_kth_from_start(st, 0) == arr));
+  const int SZ = 10;
+  int       ids[SZ];
+  size_t    alive = objects_snapshot(ids, SZ);
+  assert((alive == 5));
+  for (int i = 0; i < N; i += N / 4) {
+    assert((strcmp(((char **)arr)[i], "element") == 0));
+  }
+
+  vstack_pop(st);
+  force_gc_cycle(st);
+  assert((!is_large_object((void *)arr)));
+  assert((objects_snapshot(ids, SZ) == 0));
+
+  cleanup_test(st);
+}
+
+void test_sliding_compaction_across_blocks (void) {
+  virt_stack *st = init_test();
+
+  // survivors of different sizes straddle blocks of the offset table, each refers to the previous one
+  const int N = 16;
+  vstack_push(st, BOX(0));
+  for (int i = 0; i < N; ++i) {
+    call_runtime_function(vstack_top(st) - 4, LmakeArray, 1, BOX(70 + i));
+    size_t arr = call_runtime_function(vstack_top(st) - 4, LmakeArray, 1, BOX(50 + 3 * i));
+    call_runtime_function(vstack_top(st) - 4, Bsta, 3, vstack_kth_from_start(st, i), BOX(0), arr);
+    vstack_push(st, arr);
+  }
+  force_gc_cycle(st);
+
+  // they slide next to each other in address order, references follow them
+  for (int i = 1; i < N; ++i) {
+    size_t prev = vstack_kth_from_start(st, i), arr = vstack_kth_from_start(st, i + 1);
+    assert((arr == prev + array_size(50 + 3 * (i - 1))));
+    assert((((size_t *)arr)[0] == prev));
+  }
+
+  cleanup_test(st);
+}
+
+extern size_t __gc_stack_watermark, __gc_stack_frame_limit;
+
+void test_stack_watermark (void) {
+  virt_stack *st = init_test();
+
+  // allocated first, so that its death makes objects below the watermark move
+  void *garbage = (void *)call_runtime_function(vstack_top(st) - 4, Bstring, 1, "garbage");
+  push_extra_root(&garbage);
+  const int N = 100;
+  for (int i = 0; i < N; ++i) {
+    vstack_push(st, call_runtime_function(vstack_top(st) - 4, Bstring, 1, "old frame"));
+  }
+  pop_extra_root(&garbage);
+  vstack_push(st, (size_t)garbage);
+  // frames holding old strings are below the current one, which consists of the top slot only
+  __gc_stack_frame_limit = (size_t)((size_t *)vstack_top(st) + 1);
+  force_gc_cycle(st);
+  assert((__gc_stack_watermark == __gc_stack_frame_limit));
+
+  vstack_pop(st);
+  force_gc_cycle(st);
+
+  const int SZ = 2 * N;
+  int       ids[SZ];
+  size_t    alive = objects_snapshot(ids, SZ);
+  assert((alive == N));
+  for (int i = 0; i < N; ++i) {
+    assert((strcmp((char *)vstack_kth_from_start(st, i), "old frame") == 0));
+  }
+
+  __gc_stack_frame_limit = 0;
+  __gc_stack_watermark   = 0;
+  cleanup_test(st);
+}
+
 extern size_t cur_id;
 
 size_t generate_random_obj_forest (virt_stack *st, int cnt, int seed) {
@@ -246,6 +644,161 @@ void run_stress_test_random_obj_forest (int seed) {
   cleanup_test(st);
 }
 
+void run_stress_test_random_obj_forest_incremental (int seed) {
+  virt_stack *st = init_test();
+  gc_set_incremental_marking(16);
+
+  const int SZ = 100000;
+
+  size_t expectedAlive = generate_random_obj_forest(st, SZ, seed);
+  // objects allocated during the last marking cycle survive it as floating garbage
+  force_gc_cycle(st);
+
+  int    ids[SZ];
+  size_t alive = objects_snapshot(ids, SZ);
+  assert(alive == expectedAlive);
+
+  // check that order is indeed preserved
+  for (int i = 0; i < alive - 1; ++i) { assert((ids[i] < ids[i + 1])); }
+
+  gc_set_incremental_marking(0);
+  cleanup_test(st);
+}
+
+void run_stress_test_random_obj_forest_in_mode (gc_mode mode, int seed) {
+  gc_set_mode(mode);
+  virt_stack *st = init_test();
+
+  const int SZ = 100000;
+
+  size_t expectedAlive = generate_random_obj_forest(st, SZ, seed);
+
+  // allocation order is not preserved by these collectors, so only the number of survivors is checked
+  int    ids[SZ];
+  size_t alive = objects_snapshot(ids, SZ);
+  assert(alive == expectedAlive);
+
+  cleanup_test(st);
+  gc_set_mode(GC_MODE_LISP2);
+}
+
+void test_collections_in_mode (gc_mode mode) {
+  gc_set_mode(mode);
+  test_garbage_is_reclaimed();
+  test_alive_are_not_reclaimed();
+  gc_set_mode(GC_MODE_LISP2);
+}
+
+void test_mark_region_evacuation (void) {
+  gc_set_mode(GC_MODE_MARK_REGION);
+  virt_stack *st = init_test();
+
+  const int N = 20000;
+  for (int i = 0; i < N; ++i) {
+    vstack_push(st, call_runtime_function(vstack_top(st) - 4, Bstring, 1, "survivor"));
+  }
+  // only every 64th string stays alive, so that all blocks become sparsely occupied
+  for (int i = 0; i < N; ++i) {
+    if (i % 64 != 0) { st->buf[RUNTIME_VSTACK_SIZE - 1 - i] = BOX(0); }
+  }
+  force_gc_cycle(st);
+  size_t before = vstack_kth_from_start(st, 0);
+  // sparse blocks are evacuated by the next collection
+  force_gc_cycle(st);
+  assert((vstack_kth_from_start(st, 0) != before));
+
+  int    ids[N];
+  size_t alive = objects_snapshot(ids, N);
+  assert((alive == (N + 63) / 64));
+  for (int i = 0; i < N; i += 64) {
+    assert((strcmp((char *)vstack_kth_from_start(st, i), "survivor") == 0));
+  }
+
+  cleanup_test(st);
+  gc_set_mode(GC_MODE_LISP2);
+}
+
+void test_mark_region_heap_stays_bounded (void) {
+  gc_set_mode(GC_MODE_MARK_REGION);
+  virt_stack *st = init_test();
+
+  // every round replaces the live set by as many fresh survivors scattered over sparse blocks, so
+  // every collection evacuates and frees blocks which the next rounds have to reuse
+  const int N = 20000, ROUNDS = 40;
+  size_t    bounded = 0;
+  for (int r = 0; r < ROUNDS; ++r) {
+    while (vstack_size(st) > 0) { vstack_pop(st); }
+    for (int i = 0; i < N; ++i) {
+      vstack_push(st, call_runtime_function(vstack_top(st) - 4, Bstring, 1, "survivor"));
+    }
+    for (int i = 0; i < N; ++i) {
+      if (i % 64 != 0) { st->buf[RUNTIME_VSTACK_SIZE - 1 - i] = BOX(0); }
+    }
+    force_gc_cycle(st);
+    force_gc_cycle(st);
+    size_t used = heap.current - heap.begin;
+    if (r == ROUNDS / 4) { bounded = used; }
+    assert((r <= ROUNDS / 4 || used <= bounded));
+  }
+  for (int i = 0; i < N; i += 64) {
+    assert((strcmp((char *)vstack_kth_from_start(st, i), "survivor") == 0));
+  }
+
+  cleanup_test(st);
+  gc_set_mode(GC_MODE_LISP2);
+}
+
+void test_mark_sweep_does_not_move (void) {
+  gc_set_mode(GC_MODE_MARK_SWEEP);
+  virt_stack *st = init_test();
+
+  vstack_push(st, call_runtime_function(vstack_top(st) - 4, Bstring, 1, "kept"));
+  size_t dead = call_runtime_function(vstack_top(st) - 4, Bstring, 1, "dead");
+  size_t kept = vstack_kth_from_start(st, 0);
+  force_gc_cycle(st);
+  assert((vstack_kth_from_start(st, 0) == kept));
+
+  // the cell of the dead string is found by the lazy sweep and reused
+  size_t reused = call_runtime_function(vstack_top(st) - 4, Bstring, 1, "next");
+  assert((reused == dead));
+  int    ids[4];
+  size_t alive = objects_snapshot(ids, 4);
+  assert((alive == 2));
+
+  cleanup_test(st);
+  gc_set_mode(GC_MODE_LISP2);
+}
+
+extern int Lhash (void *p);
+
+// objects outside the heap, in the large-object space, are looked into like any other object
+void test_runtime_functions_on_large_objects (gc_mode mode, int length) {
+  gc_set_mode(mode);
+  virt_stack *st = init_test();
+
+  for (int k = 0; k < 2; ++k) {
+    vstack_push(st, call_runtime_function(vstack_top(st) - 4, LmakeArray, 1, BOX(length)));
+  }
+  int *a = (int *)vstack_kth_from_start(st, 0), *b = (int *)vstack_kth_from_start(st, 1);
+  assert((is_large_object(a) && is_large_object(b)));
+  for (int i = 0; i < length; ++i) { a[i] = b[i] = BOX(i % 10); }
+  assert((Lcompare(a, b) == BOX(0)));
+  assert((Lhash(a) == Lhash(b)));
+  b[0] = BOX(5);
+  assert((Lhash(a) != Lhash(b)));
+  b[0] = BOX(0);
+
+  char *rendered = (char *)call_runtime_function(vstack_top(st) - 4, Lstring, 1, a);
+  assert((strncmp(rendered, "[0, 1, 2, 3, ", 13) == 0));
+
+  b[length - 1] = BOX(42);
+  assert((Lcompare(a, b) == BOX((length - 1) % 10 - 42)));
+  assert((Lcompare(b, a) == BOX(42 - (length - 1) % 10)));
+
+  cleanup_test(st);
+  gc_set_mode(GC_MODE_LISP2);
+}
+
 #endif
 
 #include <time.h>
@@ -258,16 +811,43 @@ int main (int argc, char **argv) {
   test_simple_array_alloc();
   test_simple_sexp_alloc();
   test_simple_closure_alloc();
+  test_string_rendering();
+  test_structural_compare();
   test_single_object_allocation_with_collection_virtual_stack();
   test_garbage_is_reclaimed();
   test_alive_are_not_reclaimed();
   test_small_tree_compaction();
+  test_stack_watermark();
+  test_gc_stats();
+  test_heap_shrinks_after_peak();
+  test_alloc_profile();
+  test_heap_census();
+  test_heap_census_with_alloc_profile();
+  test_strings_in_pointer_free_space();
+  test_hierarchical_compaction_order();
+  test_incremental_marking_write_barrier();
+  test_large_object_is_not_moved();
+  test_sliding_compaction_across_blocks();
+  test_collections_in_mode(GC_MODE_MARK_REGION);
+  test_collections_in_mode(GC_MODE_SEMISPACE);
+  test_collections_in_mode(GC_MODE_MARK_SWEEP);
+  test_mark_region_evacuation();
+  test_mark_region_heap_stays_bounded();
+  test_mark_sweep_does_not_move();
+  test_runtime_functions_on_large_objects(GC_MODE_LISP2, LARGE_OBJECT_WORDS);
+  test_runtime_functions_on_large_objects(GC_MODE_MARK_SWEEP, SWEEP_MAX_CELL_WORDS + 1);
 
   time_t start, end;
   double diff;
   time(&start);
   // stress test
   for (int s = 0; s < 100; ++s) { run_stress_test_random_obj_forest(s); }
+  for (int s = 0; s < 20; ++s) {
+    run_stress_test_random_obj_forest_in_mode(GC_MODE_MARK_REGION, s);
+    run_stress_test_random_obj_forest_in_mode(GC_MODE_SEMISPACE, s);
+    run_stress_test_random_obj_forest_in_mode(GC_MODE_MARK_SWEEP, s);
+    run_stress_test_random_obj_forest_incremental(s);
+  }
   time(&end);
   diff = difftime(end, start);
   printf("Stress tests took %.2lf seconds to complete\n", diff);